@@ -6,24 +6,43 @@
 #include "TBranch.h"
 #include "TFile.h"
 #include "TLeaf.h"
+#include "TROOT.h"
 #include "TTree.h"
 #include "TTreeReader.h"
+#include "TTreeReaderArray.h"
 #include "TTreeReaderValue.h"
+#include "ROOT/RVec.hxx"
 #include "Rtypes.h"
 #include <RVersion.h>
 
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <algorithm>
+#include <atomic>
 #include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <exception>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <iterator>
 #include <limits>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <numeric>
 #include <optional>
+#include <set>
 #include <stdexcept>
 #include <string>
 #include <string_view>
 #include <system_error>
-#include <unordered_map>
+#include <thread>
 #include <unordered_set>
 #include <utility>
 #include <vector>
@@ -31,26 +50,71 @@
 namespace {
 
 using ColumnOverride = std::pair<std::string, std::string>;
+using proc::sanitiseComponent;
 
 struct ColumnSpec {
-    enum class ValueType { Float, Double };
+    // FloatVector columns come from array, std::vector or RVec branches (or 2-D NumPy arrays)
+    // and are written as RVec<float>; leaf_type is then the element type.
+    enum class ValueType { Float, Double, FloatVector };
 
     std::string input_name;
     std::string output_name;
     EDataType leaf_type = kNoType_t;
     ValueType value_type = ValueType::Double;
+    // Values per row of a FloatVector column, the same for every row; 0 until the first row
+    // of a variable-length branch is read.
+    std::size_t width = 1;
+    // Index into ScoreTable::floats, doubles or vectors, depending on value_type.
+    std::size_t slot = 0;
 };
 
+// How rows sharing an event_uid are resolved when the score table is built.
+enum class DuplicatePolicy { kLast, kFirst, kError, kAverage };
+
+// Columnar score table: uids sorted ascending, with one typed array per column holding the
+// value of row i at index i. An event is looked up once and every column read at that row.
+// Vector columns are stored contiguously, row i at [i * width, (i + 1) * width).
 struct ScoreTable {
     std::vector<ColumnSpec> columns;
-    std::unordered_map<ULong64_t, std::vector<double>> values;
+    std::vector<ULong64_t> uids;
+    std::vector<std::vector<float>> floats;
+    std::vector<std::vector<double>> doubles;
+    std::vector<std::vector<float>> vectors;
     std::size_t total_rows = 0;
     std::size_t duplicate_uids = 0;
+
+    // Rows [begin, end) whose uids fall in [first, last], the only rows an entry with that
+    // uid range can match.
+    struct Slice {
+        std::size_t begin = 0;
+        std::size_t end = 0;
+        std::size_t size() const noexcept { return end - begin; }
+    };
+
+    Slice slice(ULong64_t first, ULong64_t last) const {
+        const auto begin = std::lower_bound(uids.begin(), uids.end(), first);
+        const auto end = std::upper_bound(begin, uids.end(), last);
+        return Slice{static_cast<std::size_t>(begin - uids.begin()), static_cast<std::size_t>(end - uids.begin())};
+    }
+
+    Slice all() const noexcept { return Slice{0, uids.size()}; }
+
+    // Row of uid within the slice, or -1 when it has no scores.
+    Long64_t find(ULong64_t uid, const Slice &range) const {
+        const auto first = uids.begin() + static_cast<std::ptrdiff_t>(range.begin);
+        const auto last = uids.begin() + static_cast<std::ptrdiff_t>(range.end);
+        const auto it = std::lower_bound(first, last, uid);
+        return it != last && *it == uid ? static_cast<Long64_t>(it - uids.begin()) : -1;
+    }
 };
 
-struct Options {
-    bool show_help = false;
-    std::string hub_path;
+// Hidden columns holding the score row of each event (indexed table) or whether the stream
+// cursor matched it (streaming join); neither is written to the friend.
+constexpr const char *kScoreRowColumn = "hub_attach_row_";
+constexpr const char *kScoreMatchColumn = "hub_attach_match_";
+
+// One score set, attached as its own friend under label.
+struct ScoreSource {
     std::string scores_path;
     std::string scores_tree;
     std::string label;
@@ -59,24 +123,30 @@ struct Options {
     std::vector<ColumnOverride> column_overrides;
 };
 
-std::string sanitiseComponent(const std::string &value) {
-    if (value.empty()) {
-        return std::string{"none"};
-    }
-    std::string result;
-    result.reserve(value.size());
-    for (char ch : value) {
-        const unsigned char uc = static_cast<unsigned char>(ch);
-        if (std::isalnum(uc) || ch == '_' || ch == '-') {
-            result.push_back(static_cast<char>(uc));
-        } else {
-            result.push_back('_');
-        }
-    }
-    if (result.empty()) {
-        return std::string{"none"};
+struct Options {
+    bool show_help = false;
+    std::string hub_path;
+    // In command-line order; every source is written from the same event loop per entry.
+    std::vector<ScoreSource> sources;
+    proc::FriendFormat format = proc::FriendFormat::kTTree;
+    bool align_clusters = false;
+    bool streaming = false;
+    std::size_t threads = std::max(1U, std::thread::hardware_concurrency());
+    DuplicatePolicy duplicates = DuplicatePolicy::kLast;
+};
+
+const char *duplicatePolicyName(DuplicatePolicy policy) {
+    switch (policy) {
+    case DuplicatePolicy::kFirst:
+        return "first";
+    case DuplicatePolicy::kError:
+        return "error";
+    case DuplicatePolicy::kAverage:
+        return "average";
+    case DuplicatePolicy::kLast:
+    default:
+        return "last";
     }
-    return result;
 }
 
 std::string trim(const std::string &value) {
@@ -89,18 +159,51 @@ std::string trim(const std::string &value) {
 }
 
 void printUsage() {
-    std::cout << "Usage: hub-attach-friends --hub <hub> --scores <scores.root> --tree <tree> --label <label>"
-              << " [--friend-tree <name>] [--output-dir <dir>] [--columns a,b,c]" << std::endl;
+    std::cout << "Usage: hub-attach-friends --hub <hub> --scores <scores.root|.npz|.npy|glob|list> [--tree <tree>]"
+              << " --label <label>"
+              << " [--friend-tree <name>] [--output-dir <dir>] [--columns a,b,c] [--format ttree|rntuple]"
+              << " [--align-clusters] [--streaming] [--threads <n>] [--duplicates last|first|error|average]"
+              << std::endl;
+    std::cout << "\nSeveral score sets can be attached in one pass: repeat --scores [--tree] --label [--friend-tree]"
+              << std::endl;
+    std::cout << "[--output-dir] [--columns] once per set. Each set gets its own friend, all written from the same"
+              << std::endl;
+    std::cout << "event loop per entry, and the catalogue is updated once." << std::endl;
     std::cout << "\nOptions:" << std::endl;
     std::cout << "  --hub           Path to the hub catalogue (.hub.root)" << std::endl;
-    std::cout << "  --scores        ROOT file containing CNN scores" << std::endl;
-    std::cout << "  --tree          TTree within the score file (for example cnn_output)" << std::endl;
+    std::cout << "  --scores        ROOT file containing CNN scores, a glob such as 'scores/*.root', or a .txt/.list"
+              << std::endl;
+    std::cout << "                   file naming one shard per line; shards are read in parallel. NumPy shards are"
+              << std::endl;
+    std::cout << "                   memory-mapped: an uncompressed .npz with event_uid and score arrays, or a .npy"
+              << std::endl;
+    std::cout << "                   with its uids in <stem>_event_uid.npy. Globs and lists skip those uid files,"
+              << std::endl;
+    std::cout << "                   so 'scores/*.npy' picks up only the score arrays" << std::endl;
+    std::cout << "  --tree          TTree within the score file (for example cnn_output); unused for NumPy input"
+              << std::endl;
     std::cout << "  --label         Alias used when attaching the friend (e.g. cnn)" << std::endl;
     std::cout << "  --friend-tree   Optional name for the friend TTree (defaults to --label)" << std::endl;
     std::cout << "  --output-dir    Output directory for friend shards (relative paths are resolved against the hub)"
               << std::endl;
     std::cout << "  --columns       Comma-separated list of score branches (use input or input:output to rename)." << std::endl;
     std::cout << "                   When omitted, all floating-point score columns are attached automatically." << std::endl;
+    std::cout << "                   Array, std::vector and RVec branches and 2-D NumPy arrays are attached as one"
+              << std::endl;
+    std::cout << "                   RVec<float> column each; every row must have the same length." << std::endl;
+    std::cout << "  --format        Friend storage format: ttree (default) or rntuple (ROOT >= 6.34). RNTuple friends"
+              << std::endl;
+    std::cout << "                   are read with Selection::loadFriend; load() rejects them unless columns() leaves"
+              << std::endl;
+    std::cout << "                   their label out" << std::endl;
+    std::cout << "  --align-clusters Close friend clusters at the dataset tree's cluster edges" << std::endl;
+    std::cout << "  --streaming     Merge-join each entry against a uid-sorted score tree instead of loading it;"
+              << std::endl;
+    std::cout << "                   falls back to the in-memory table when the scores are not sorted" << std::endl;
+    std::cout << "  --threads       Shards read and catalogue entries attached concurrently (default: hardware threads)"
+              << std::endl;
+    std::cout << "  --duplicates    Rows sharing an event_uid: keep the last (default) or first read, fail, or average"
+              << std::endl;
 }
 
 Options parseOptions(int argc, char **argv) {
@@ -118,19 +221,61 @@ Options parseOptions(int argc, char **argv) {
             return std::string{argv[++i]};
         };
 
+        // Source options fill the current source; repeating one that is already set starts
+        // the next source.
+        auto source_for = [&](auto field) -> ScoreSource & {
+            if (opts.sources.empty() || !(opts.sources.back().*field).empty()) {
+                opts.sources.emplace_back();
+            }
+            return opts.sources.back();
+        };
+
         if (arg == "--hub") {
             opts.hub_path = trim(require_value("--hub"));
         } else if (arg == "--scores") {
-            opts.scores_path = trim(require_value("--scores"));
+            source_for(&ScoreSource::scores_path).scores_path = trim(require_value("--scores"));
         } else if (arg == "--tree") {
-            opts.scores_tree = trim(require_value("--tree"));
+            source_for(&ScoreSource::scores_tree).scores_tree = trim(require_value("--tree"));
         } else if (arg == "--label") {
-            opts.label = trim(require_value("--label"));
+            source_for(&ScoreSource::label).label = trim(require_value("--label"));
         } else if (arg == "--friend-tree") {
-            opts.friend_tree = trim(require_value("--friend-tree"));
+            source_for(&ScoreSource::friend_tree).friend_tree = trim(require_value("--friend-tree"));
         } else if (arg == "--output-dir") {
-            opts.output_dir = std::filesystem::path{trim(require_value("--output-dir"))};
+            source_for(&ScoreSource::output_dir).output_dir =
+                std::filesystem::path{trim(require_value("--output-dir"))};
+        } else if (arg == "--format") {
+            const auto format = trim(require_value("--format"));
+            if (format == "ttree") {
+                opts.format = proc::FriendFormat::kTTree;
+            } else if (format == "rntuple") {
+                opts.format = proc::FriendFormat::kRNTuple;
+            } else {
+                throw std::runtime_error("Unknown friend format: " + format);
+            }
+        } else if (arg == "--align-clusters") {
+            opts.align_clusters = true;
+        } else if (arg == "--streaming") {
+            opts.streaming = true;
+        } else if (arg == "--threads") {
+            opts.threads = static_cast<std::size_t>(std::stoul(require_value("--threads")));
+        } else if (arg == "--duplicates") {
+            const auto policy = trim(require_value("--duplicates"));
+            if (policy == "last") {
+                opts.duplicates = DuplicatePolicy::kLast;
+            } else if (policy == "first") {
+                opts.duplicates = DuplicatePolicy::kFirst;
+            } else if (policy == "error") {
+                opts.duplicates = DuplicatePolicy::kError;
+            } else if (policy == "average") {
+                opts.duplicates = DuplicatePolicy::kAverage;
+            } else {
+                throw std::runtime_error("Unknown duplicate policy: " + policy);
+            }
         } else if (arg == "--columns") {
+            if (opts.sources.empty()) {
+                opts.sources.emplace_back();
+            }
+            auto &column_overrides = opts.sources.back().column_overrides;
             std::string list = require_value("--columns");
             std::size_t start = 0U;
             while (start < list.size()) {
@@ -140,14 +285,14 @@ Options parseOptions(int argc, char **argv) {
                 if (!token.empty()) {
                     auto colon = token.find(':');
                     if (colon == std::string::npos) {
-                        opts.column_overrides.emplace_back(token, token);
+                        column_overrides.emplace_back(token, token);
                     } else {
                         const std::string input = trim(token.substr(0, colon));
                         const std::string output = trim(token.substr(colon + 1));
                         if (input.empty() || output.empty()) {
                             throw std::runtime_error("Column override must not be empty");
                         }
-                        opts.column_overrides.emplace_back(input, output);
+                        column_overrides.emplace_back(input, output);
                     }
                 }
                 if (end == std::string::npos) {
@@ -262,6 +407,62 @@ ColumnSpec::ValueType inferValueType(EDataType type) {
     }
 }
 
+// Element type of a std::vector or RVec branch of float or double, kNoType_t otherwise.
+EDataType collectionElementType(const TBranch *branch) {
+    const std::string class_name = branch->GetClassName();
+    const auto open = class_name.find('<');
+    if (open == std::string::npos ||
+        (class_name.find("vector") != 0 && class_name.find("std::vector") != 0 &&
+         class_name.find("RVec") == std::string::npos)) {
+        return kNoType_t;
+    }
+    const auto element = trim(class_name.substr(open + 1, class_name.rfind('>') - open - 1));
+    if (element == "float" || element == "Float_t") {
+        return kFloat_t;
+    }
+    if (element == "double" || element == "Double_t") {
+        return kDouble_t;
+    }
+    return kNoType_t;
+}
+
+// Column for a score branch: flat scalar leaves keep their type, while fixed-size or counted
+// leaf arrays and std::vector/RVec branches become vector columns. Returns nullopt with the
+// reason when the branch cannot be attached.
+std::optional<ColumnSpec> describeScoreBranch(TBranch *branch, const std::string &name, std::string &reason) {
+    ColumnSpec spec;
+    spec.input_name = name;
+    spec.output_name = name;
+    if (const auto element = collectionElementType(branch); element != kNoType_t) {
+        spec.leaf_type = element;
+        spec.value_type = ColumnSpec::ValueType::FloatVector;
+        spec.width = 0;
+        return spec;
+    }
+
+    auto *leaf = branch->GetLeaf(name.c_str());
+    if (!leaf) {
+        reason = "is missing a leaf definition";
+        return std::nullopt;
+    }
+    const auto type = getLeafType(leaf);
+    if (!isSupportedLeaf(type)) {
+        reason = "uses an unsupported data type";
+        return std::nullopt;
+    }
+    spec.leaf_type = type;
+    if (leaf->GetLeafCount() != nullptr) {
+        spec.value_type = ColumnSpec::ValueType::FloatVector;
+        spec.width = 0;
+    } else if (leaf->GetLen() > 1) {
+        spec.value_type = ColumnSpec::ValueType::FloatVector;
+        spec.width = static_cast<std::size_t>(leaf->GetLen());
+    } else {
+        spec.value_type = inferValueType(type);
+    }
+    return spec;
+}
+
 std::vector<ColumnSpec> buildColumnSpecs(TTree *tree, const std::vector<ColumnOverride> &overrides) {
     if (!tree) {
         throw std::runtime_error("Score file does not contain the requested tree");
@@ -282,26 +483,16 @@ std::vector<ColumnSpec> buildColumnSpecs(TTree *tree, const std::vector<ColumnOv
             if (!branch) {
                 throw std::runtime_error("Score column '" + input + "' was not found in " + std::string{tree->GetName()});
             }
-        auto *leaf = branch->GetLeaf(input.c_str());
-        if (!leaf) {
-            throw std::runtime_error("Score column '" + input + "' is missing a leaf definition");
-        }
-        if (leaf->GetLen() > 1 || leaf->GetLeafCount() != nullptr) {
-            throw std::runtime_error("Score column '" + input + "' is not a flat scalar branch");
-        }
-        const auto type = getLeafType(leaf);
-        if (!isSupportedLeaf(type)) {
-            throw std::runtime_error("Score column '" + input + "' uses an unsupported data type");
-        }
+            std::string reason;
+            auto spec = describeScoreBranch(branch, input, reason);
+            if (!spec) {
+                throw std::runtime_error("Score column '" + input + "' " + reason);
+            }
             if (!seen_outputs.insert(output).second) {
                 throw std::runtime_error("Duplicate output column name '" + output + "' requested");
             }
-            ColumnSpec spec;
-            spec.input_name = input;
-            spec.output_name = output;
-            spec.leaf_type = type;
-            spec.value_type = inferValueType(type);
-            specs.push_back(std::move(spec));
+            spec->output_name = output;
+            specs.push_back(std::move(*spec));
         }
         return specs;
     }
@@ -317,26 +508,12 @@ std::vector<ColumnSpec> buildColumnSpecs(TTree *tree, const std::vector<ColumnOv
         if (name == "event_uid") {
             continue;
         }
-        auto *leaf = branch->GetLeaf(name.c_str());
-        if (!leaf) {
-            continue;
-        }
-        const auto type = getLeafType(leaf);
-        if (!isSupportedLeaf(type)) {
-            continue;
-        }
-        if (leaf->GetLen() > 1 || leaf->GetLeafCount() != nullptr) {
+        std::string reason;
+        auto spec = describeScoreBranch(branch, name, reason);
+        if (!spec || !seen_outputs.insert(name).second) {
             continue;
         }
-        if (!seen_outputs.insert(name).second) {
-            continue;
-        }
-        ColumnSpec spec;
-        spec.input_name = name;
-        spec.output_name = name;
-        spec.leaf_type = type;
-        spec.value_type = inferValueType(type);
-        specs.push_back(std::move(spec));
+        specs.push_back(std::move(*spec));
     }
 
     return specs;
@@ -381,43 +558,161 @@ struct ColumnReader : ColumnReaderBase {
     TTreeReaderValue<T> value_reader;
 };
 
-std::unique_ptr<ColumnReaderBase> buildColumnReader(TTreeReader &reader, const ColumnSpec &spec) {
+struct ArrayReaderBase {
+    virtual ~ArrayReaderBase() = default;
+    virtual std::size_t size() = 0;
+    // Writes the current row's values, as floats, to out[0, size()).
+    virtual void read(float *out) = 0;
+};
+
+template <typename T>
+struct ArrayReader : ArrayReaderBase {
+    ArrayReader(TTreeReader &reader, const std::string &column) : values(reader, column.c_str()) {}
+    std::size_t size() override { return values.GetSize(); }
+    void read(float *out) override {
+        for (std::size_t idx = 0, n = values.GetSize(); idx < n; ++idx) {
+            out[idx] = static_cast<float>(values[idx]);
+        }
+    }
+    TTreeReaderArray<T> values;
+};
+
+// Reader of spec.input_name as its leaf type, for scalar (ColumnReader) or array (ArrayReader) columns.
+template <template <typename> class Reader, typename Base>
+std::unique_ptr<Base> buildTypedReader(TTreeReader &reader, const ColumnSpec &spec) {
     switch (spec.leaf_type) {
     case kFloat_t:
     case kFloat16_t:
 #ifdef kFloat16Alt_t
     case kFloat16Alt_t:
 #endif
-        return std::make_unique<ColumnReader<Float_t>>(reader, spec.input_name);
+        return std::make_unique<Reader<Float_t>>(reader, spec.input_name);
     case kDouble_t:
     case kDouble32_t:
-        return std::make_unique<ColumnReader<Double_t>>(reader, spec.input_name);
+        return std::make_unique<Reader<Double_t>>(reader, spec.input_name);
     case kInt_t:
-        return std::make_unique<ColumnReader<Int_t>>(reader, spec.input_name);
+        return std::make_unique<Reader<Int_t>>(reader, spec.input_name);
     case kUInt_t:
-        return std::make_unique<ColumnReader<UInt_t>>(reader, spec.input_name);
+        return std::make_unique<Reader<UInt_t>>(reader, spec.input_name);
     case kLong64_t:
-        return std::make_unique<ColumnReader<Long64_t>>(reader, spec.input_name);
+        return std::make_unique<Reader<Long64_t>>(reader, spec.input_name);
     case kULong64_t:
-        return std::make_unique<ColumnReader<ULong64_t>>(reader, spec.input_name);
+        return std::make_unique<Reader<ULong64_t>>(reader, spec.input_name);
     case kShort_t:
-        return std::make_unique<ColumnReader<Short_t>>(reader, spec.input_name);
+        return std::make_unique<Reader<Short_t>>(reader, spec.input_name);
     case kUShort_t:
-        return std::make_unique<ColumnReader<UShort_t>>(reader, spec.input_name);
+        return std::make_unique<Reader<UShort_t>>(reader, spec.input_name);
     case kChar_t:
-        return std::make_unique<ColumnReader<Char_t>>(reader, spec.input_name);
+        return std::make_unique<Reader<Char_t>>(reader, spec.input_name);
     case kUChar_t:
-        return std::make_unique<ColumnReader<UChar_t>>(reader, spec.input_name);
+        return std::make_unique<Reader<UChar_t>>(reader, spec.input_name);
     case kBool_t:
-        return std::make_unique<ColumnReader<Bool_t>>(reader, spec.input_name);
+        return std::make_unique<Reader<Bool_t>>(reader, spec.input_name);
     default:
         throw std::runtime_error("Unsupported score column type encountered");
     }
 }
 
-ScoreTable loadScoreTable(const std::string &file_path, const std::string &tree_name,
-                          const std::vector<ColumnOverride> &overrides) {
-    TFile score_file(file_path.c_str(), "READ");
+std::unique_ptr<ColumnReaderBase> buildColumnReader(TTreeReader &reader, const ColumnSpec &spec) {
+    return buildTypedReader<ColumnReader, ColumnReaderBase>(reader, spec);
+}
+
+std::unique_ptr<ArrayReaderBase> buildArrayReader(TTreeReader &reader, const ColumnSpec &spec) {
+    return buildTypedReader<ArrayReader, ArrayReaderBase>(reader, spec);
+}
+
+// Fixes the width of a variable-length vector column at its first row; every later row must
+// match, since the table and the friend's RVec<float> rely on one length per column.
+void checkVectorWidth(ColumnSpec &spec, std::size_t size, bool first_row) {
+    if (first_row && spec.width == 0) {
+        spec.width = size;
+    } else if (size != spec.width) {
+        throw std::runtime_error("Score column '" + spec.input_name + "' has rows of " + std::to_string(size) +
+                                 " and " + std::to_string(spec.width) + " values; vector columns need a fixed length");
+    }
+}
+
+// Sorts the rows by uid and resolves rows sharing a uid with the policy. Rows keep their
+// read order among equal uids, so "last" means the last shard and row read.
+void sortScoreTable(ScoreTable &table, DuplicatePolicy policy) {
+    const std::size_t n = table.uids.size();
+    const bool sorted = std::is_sorted(table.uids.begin(), table.uids.end());
+    std::vector<std::size_t> order(n);
+    std::iota(order.begin(), order.end(), std::size_t{0});
+    if (!sorted) {
+        std::stable_sort(order.begin(), order.end(),
+                         [&](std::size_t a, std::size_t b) { return table.uids[a] < table.uids[b]; });
+    }
+    if (sorted && std::adjacent_find(table.uids.begin(), table.uids.end()) == table.uids.end()) {
+        return;
+    }
+
+    std::vector<std::size_t> widths(table.vectors.size());
+    for (const auto &column : table.columns) {
+        if (column.value_type == ColumnSpec::ValueType::FloatVector) {
+            widths[column.slot] = column.width;
+        }
+    }
+
+    std::vector<ULong64_t> uids;
+    std::vector<std::vector<float>> floats(table.floats.size());
+    std::vector<std::vector<double>> doubles(table.doubles.size());
+    std::vector<std::vector<float>> vectors(table.vectors.size());
+    uids.reserve(n);
+    for (std::size_t begin = 0, end = 0; begin < n; begin = end) {
+        const auto uid = table.uids[order[begin]];
+        end = begin + 1;
+        while (end < n && table.uids[order[end]] == uid) {
+            ++end;
+        }
+        const std::size_t copies = end - begin;
+        table.duplicate_uids += copies - 1;
+        if (copies > 1 && policy == DuplicatePolicy::kError) {
+            throw std::runtime_error("event_uid " + std::to_string(uid) + " has " + std::to_string(copies) +
+                                     " score rows");
+        }
+
+        uids.push_back(uid);
+        if (policy == DuplicatePolicy::kAverage && copies > 1) {
+            auto mean = [&](const auto &values, std::size_t width, std::size_t element) {
+                double sum = 0.0;
+                for (std::size_t idx = begin; idx < end; ++idx) {
+                    sum += static_cast<double>(values[order[idx] * width + element]);
+                }
+                return sum / static_cast<double>(copies);
+            };
+            for (std::size_t slot = 0; slot < floats.size(); ++slot) {
+                floats[slot].push_back(static_cast<float>(mean(table.floats[slot], 1, 0)));
+            }
+            for (std::size_t slot = 0; slot < doubles.size(); ++slot) {
+                doubles[slot].push_back(mean(table.doubles[slot], 1, 0));
+            }
+            for (std::size_t slot = 0; slot < vectors.size(); ++slot) {
+                for (std::size_t element = 0; element < widths[slot]; ++element) {
+                    vectors[slot].push_back(static_cast<float>(mean(table.vectors[slot], widths[slot], element)));
+                }
+            }
+            continue;
+        }
+        const std::size_t row = policy == DuplicatePolicy::kFirst ? order[begin] : order[end - 1];
+        for (std::size_t slot = 0; slot < floats.size(); ++slot) {
+            floats[slot].push_back(table.floats[slot][row]);
+        }
+        for (std::size_t slot = 0; slot < doubles.size(); ++slot) {
+            doubles[slot].push_back(table.doubles[slot][row]);
+        }
+        for (std::size_t slot = 0; slot < vectors.size(); ++slot) {
+            const auto first = table.vectors[slot].begin() + static_cast<std::ptrdiff_t>(row * widths[slot]);
+            vectors[slot].insert(vectors[slot].end(), first, first + static_cast<std::ptrdiff_t>(widths[slot]));
+        }
+    }
+    table.uids = std::move(uids);
+    table.floats = std::move(floats);
+    table.doubles = std::move(doubles);
+    table.vectors = std::move(vectors);
+}
+
+TTree *findScoreTree(TFile &score_file, const std::string &file_path, const std::string &tree_name) {
     if (score_file.IsZombie()) {
         throw std::runtime_error("Failed to open score file: " + file_path);
     }
@@ -427,51 +722,787 @@ ScoreTable loadScoreTable(const std::string &file_path, const std::string &tree_
         throw std::runtime_error("Score tree '" + tree_name + "' was not found in " + file_path);
     }
 
-    auto *uid_leaf = tree->GetLeaf("event_uid");
-    if (!uid_leaf) {
+    if (!tree->GetLeaf("event_uid")) {
         throw std::runtime_error("Score tree is missing the required event_uid branch");
     }
+    return tree;
+}
 
+std::vector<ColumnSpec> selectScoreColumns(TTree *tree, const std::vector<ColumnOverride> &overrides) {
     auto column_specs = buildColumnSpecs(tree, overrides);
     if (column_specs.empty()) {
         throw std::runtime_error("No score columns were selected for attachment");
     }
+    return column_specs;
+}
+
+// Reads one score file in its stored order; rows are sorted once all shards are merged.
+ScoreTable readScoreShard(const std::string &file_path, const std::string &tree_name,
+                          const std::vector<ColumnOverride> &overrides) {
+    TFile score_file(file_path.c_str(), "READ");
+    auto *tree = findScoreTree(score_file, file_path, tree_name);
+    auto *uid_leaf = tree->GetLeaf("event_uid");
+    auto column_specs = selectScoreColumns(tree, overrides);
 
     TTreeReader reader(tree);
     auto event_reader = buildEventReader(reader, getLeafType(uid_leaf));
 
-    std::vector<std::unique_ptr<ColumnReaderBase>> column_readers;
-    column_readers.reserve(column_specs.size());
-    for (const auto &spec : column_specs) {
-        column_readers.push_back(buildColumnReader(reader, spec));
+    // Each column has a scalar or an array reader, the other left empty.
+    std::vector<std::unique_ptr<ColumnReaderBase>> column_readers(column_specs.size());
+    std::vector<std::unique_ptr<ArrayReaderBase>> array_readers(column_specs.size());
+    for (std::size_t idx = 0; idx < column_specs.size(); ++idx) {
+        if (column_specs[idx].value_type == ColumnSpec::ValueType::FloatVector) {
+            array_readers[idx] = buildArrayReader(reader, column_specs[idx]);
+        } else {
+            column_readers[idx] = buildColumnReader(reader, column_specs[idx]);
+        }
     }
 
     ScoreTable table;
     table.columns = column_specs;
+    for (auto &spec : table.columns) {
+        if (spec.value_type == ColumnSpec::ValueType::Float) {
+            spec.slot = table.floats.size();
+            table.floats.emplace_back();
+        } else if (spec.value_type == ColumnSpec::ValueType::Double) {
+            spec.slot = table.doubles.size();
+            table.doubles.emplace_back();
+        } else {
+            spec.slot = table.vectors.size();
+            table.vectors.emplace_back();
+        }
+    }
     const auto expected = tree->GetEntries();
     if (expected > 0) {
-        table.values.reserve(static_cast<std::size_t>(expected));
+        table.uids.reserve(static_cast<std::size_t>(expected));
+        for (auto &values : table.floats) {
+            values.reserve(static_cast<std::size_t>(expected));
+        }
+        for (auto &values : table.doubles) {
+            values.reserve(static_cast<std::size_t>(expected));
+        }
+        for (const auto &spec : table.columns) {
+            if (spec.value_type == ColumnSpec::ValueType::FloatVector) {
+                const auto width = std::max<std::size_t>(1, spec.width);
+                table.vectors[spec.slot].reserve(static_cast<std::size_t>(expected) * width);
+            }
+        }
     }
 
     while (reader.Next()) {
-        const auto uid = event_reader->value();
-        std::vector<double> row;
-        row.reserve(column_readers.size());
-        for (const auto &col_reader : column_readers) {
-            row.push_back(col_reader->value());
+        const bool first_row = table.uids.empty();
+        table.uids.push_back(event_reader->value());
+        for (std::size_t idx = 0; idx < table.columns.size(); ++idx) {
+            auto &spec = table.columns[idx];
+            if (spec.value_type == ColumnSpec::ValueType::Float) {
+                table.floats[spec.slot].push_back(static_cast<float>(column_readers[idx]->value()));
+            } else if (spec.value_type == ColumnSpec::ValueType::Double) {
+                table.doubles[spec.slot].push_back(column_readers[idx]->value());
+            } else {
+                const std::size_t size = array_readers[idx]->size();
+                checkVectorWidth(spec, size, first_row);
+                auto &values = table.vectors[spec.slot];
+                values.resize(values.size() + size);
+                array_readers[idx]->read(values.data() + values.size() - size);
+            }
+        }
+    }
+    table.total_rows = table.uids.size();
+
+    return table;
+}
+
+// Read-only mapping of a whole file; pages are faulted in as the arrays are read.
+class MappedFile {
+  public:
+    explicit MappedFile(const std::string &path) {
+        fd_ = ::open(path.c_str(), O_RDONLY);
+        struct stat info {};
+        if (fd_ < 0 || ::fstat(fd_, &info) != 0) {
+            close();
+            throw std::runtime_error("Failed to open score file: " + path);
+        }
+        size_ = static_cast<std::size_t>(info.st_size);
+        if (size_ > 0) {
+            void *mapping = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+            if (mapping == MAP_FAILED) {
+                close();
+                throw std::runtime_error("Failed to map score file: " + path);
+            }
+            data_ = static_cast<const char *>(mapping);
+            ::madvise(mapping, size_, MADV_SEQUENTIAL);
+        }
+    }
+
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const char *data() const noexcept { return data_; }
+    std::size_t size() const noexcept { return size_; }
+
+  private:
+    void close() {
+        if (data_) {
+            ::munmap(const_cast<char *>(data_), size_);
+            data_ = nullptr;
+        }
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    int fd_ = -1;
+    const char *data_ = nullptr;
+    std::size_t size_ = 0;
+};
+
+// A NumPy array inside a mapping: rows are the first dimension, columns the second (1 for
+// one-dimensional arrays). Values are read with memcpy, since .npz members need not be aligned.
+struct NpyArray {
+    const char *data = nullptr;
+    std::string descr;
+    bool fortran_order = false;
+    std::size_t rows = 0;
+    std::size_t columns = 1;
+    bool matrix = false;
+
+    std::size_t itemSize() const { return static_cast<std::size_t>(std::stoul(descr.substr(2))); }
+
+    template <typename T>
+    T at(std::size_t row, std::size_t column) const {
+        const std::size_t index = fortran_order ? column * rows + row : row * columns + column;
+        T value;
+        std::memcpy(&value, data + index * sizeof(T), sizeof(T));
+        return value;
+    }
+};
+
+std::uint64_t readLittleEndian(const char *data, std::size_t bytes) {
+    std::uint64_t value = 0;
+    for (std::size_t i = 0; i < bytes; ++i) {
+        value |= static_cast<std::uint64_t>(static_cast<unsigned char>(data[i])) << (8U * i);
+    }
+    return value;
+}
+
+// Parses the .npy header at begin (format versions 1 to 3) and checks the data fits.
+NpyArray parseNpy(const char *begin, std::size_t size, const std::string &name) {
+    static const char kMagic[] = "\x93NUMPY";
+    if (size < 10 || std::memcmp(begin, kMagic, 6) != 0) {
+        throw std::runtime_error(name + " is not a NumPy array");
+    }
+    const int major = static_cast<unsigned char>(begin[6]);
+    const std::size_t length_bytes = major == 1 ? 2 : 4;
+    const std::size_t header_length = static_cast<std::size_t>(readLittleEndian(begin + 8, length_bytes));
+    const std::size_t data_offset = 8 + length_bytes + header_length;
+    if (data_offset > size) {
+        throw std::runtime_error(name + " has a truncated NumPy header");
+    }
+    const std::string header(begin + 8 + length_bytes, header_length);
+
+    auto field = [&](const std::string &key) {
+        const auto pos = header.find("'" + key + "'");
+        if (pos == std::string::npos) {
+            throw std::runtime_error(name + " header lacks '" + key + "'");
+        }
+        return header.substr(header.find(':', pos) + 1);
+    };
+
+    NpyArray array;
+    const auto descr = field("descr");
+    const auto quote = descr.find('\'');
+    array.descr = descr.substr(quote + 1, descr.find('\'', quote + 1) - quote - 1);
+    array.fortran_order = trim(field("fortran_order")).rfind("True", 0) == 0;
+
+    const auto shape = field("shape");
+    std::vector<std::size_t> dims;
+    std::string dim;
+    for (const char ch : shape.substr(shape.find('(') + 1, shape.find(')') - shape.find('(') - 1)) {
+        if (std::isdigit(static_cast<unsigned char>(ch))) {
+            dim.push_back(ch);
+        } else if (!dim.empty()) {
+            dims.push_back(static_cast<std::size_t>(std::stoull(dim)));
+            dim.clear();
+        }
+    }
+    if (!dim.empty()) {
+        dims.push_back(static_cast<std::size_t>(std::stoull(dim)));
+    }
+    if (dims.empty() || dims.size() > 2) {
+        throw std::runtime_error(name + " must be one- or two-dimensional, not of shape " + trim(shape));
+    }
+    array.rows = dims[0];
+    array.columns = dims.size() == 2 ? dims[1] : 1;
+    array.matrix = dims.size() == 2;
+
+    if (array.descr.size() < 3 || (array.descr[0] != '<' && array.descr[0] != '|')) {
+        throw std::runtime_error(name + " has dtype " + array.descr + "; only little-endian arrays are supported");
+    }
+    if (data_offset + array.rows * array.columns * array.itemSize() > size) {
+        throw std::runtime_error(name + " is shorter than its shape implies");
+    }
+    array.data = begin + data_offset;
+    return array;
+}
+
+// Members of an .npz archive, keyed by array name. Only stored (np.savez) members can be
+// mapped; compressed ones (np.savez_compressed) are rejected.
+std::map<std::string, NpyArray> parseNpz(const MappedFile &file, const std::string &path) {
+    const char *data = file.data();
+    const std::size_t size = file.size();
+    std::size_t eocd = std::string::npos;
+    for (std::size_t pos = size >= 22 ? size - 22 : 0; size >= 22; --pos) {
+        if (readLittleEndian(data + pos, 4) == 0x06054b50U) {
+            eocd = pos;
+            break;
+        }
+        if (pos == 0 || size - pos > 22 + 0xFFFF) {
+            break;
+        }
+    }
+    if (eocd == std::string::npos) {
+        throw std::runtime_error(path + " is not a zip archive");
+    }
+
+    std::uint64_t count = readLittleEndian(data + eocd + 10, 2);
+    std::uint64_t directory = readLittleEndian(data + eocd + 16, 4);
+    // Archives over 4 GiB or with more than 65535 members (zip64) saturate those fields and
+    // keep the real values in the zip64 end record, found through the locator just before.
+    if (eocd >= 20 && readLittleEndian(data + eocd - 20, 4) == 0x07064b50U) {
+        const std::uint64_t record = readLittleEndian(data + eocd - 20 + 8, 8);
+        if (record + 56 > size || readLittleEndian(data + record, 4) != 0x06064b50U) {
+            throw std::runtime_error(path + " has a corrupt zip64 end of central directory");
+        }
+        count = readLittleEndian(data + record + 32, 8);
+        directory = readLittleEndian(data + record + 48, 8);
+    } else if (directory == 0xFFFFFFFFULL) {
+        throw std::runtime_error(path + " is a zip64 archive without a zip64 end of central directory");
+    }
+    if (directory > size) {
+        throw std::runtime_error(path + " has a corrupt zip directory");
+    }
+
+    std::map<std::string, NpyArray> members;
+    std::size_t pos = static_cast<std::size_t>(directory);
+    for (std::uint64_t idx = 0; idx < count; ++idx) {
+        if (pos + 46 > size || readLittleEndian(data + pos, 4) != 0x02014b50U) {
+            throw std::runtime_error(path + " has a corrupt zip directory");
+        }
+        const auto method = readLittleEndian(data + pos + 10, 2);
+        std::uint64_t compressed = readLittleEndian(data + pos + 20, 4);
+        std::uint64_t uncompressed = readLittleEndian(data + pos + 24, 4);
+        const std::size_t name_length = static_cast<std::size_t>(readLittleEndian(data + pos + 28, 2));
+        const std::size_t extra_length = static_cast<std::size_t>(readLittleEndian(data + pos + 30, 2));
+        const std::size_t comment_length = static_cast<std::size_t>(readLittleEndian(data + pos + 32, 2));
+        std::uint64_t local = readLittleEndian(data + pos + 42, 4);
+        std::string name(data + pos + 46, name_length);
+
+        // Members over 4 GiB keep their sizes and offset in the zip64 extra field.
+        const char *extra = data + pos + 46 + name_length;
+        for (std::size_t off = 0; off + 4 <= extra_length;) {
+            const auto id = readLittleEndian(extra + off, 2);
+            const auto length = static_cast<std::size_t>(readLittleEndian(extra + off + 2, 2));
+            if (id == 0x0001U) {
+                std::size_t field = off + 4;
+                for (auto *value : {&uncompressed, &compressed, &local}) {
+                    if (*value == 0xFFFFFFFFULL && field + 8 <= off + 4 + length) {
+                        *value = readLittleEndian(extra + field, 8);
+                        field += 8;
+                    }
+                }
+            }
+            off += 4 + length;
+        }
+        pos += 46 + name_length + extra_length + comment_length;
+
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".npy") == 0) {
+            name.resize(name.size() - 4);
+        }
+        if (method != 0U) {
+            throw std::runtime_error(path + " member " + name +
+                                     " is compressed; write the archive with np.savez to map it");
+        }
+        if (local + 30 > size) {
+            throw std::runtime_error(path + " has a corrupt zip member " + name);
+        }
+        const std::size_t start = static_cast<std::size_t>(local) + 30 +
+                                  static_cast<std::size_t>(readLittleEndian(data + local + 26, 2)) +
+                                  static_cast<std::size_t>(readLittleEndian(data + local + 28, 2));
+        if (start + uncompressed > size) {
+            throw std::runtime_error(path + " member " + name + " runs past the end of the archive");
+        }
+        members.emplace(name, parseNpy(data + start, static_cast<std::size_t>(uncompressed), path + ":" + name));
+    }
+    return members;
+}
+
+bool isNumpyInput(const std::string &path) {
+    const auto extension = std::filesystem::path(path).extension();
+    return extension == ".npy" || extension == ".npz";
+}
+
+// Reads scores from NumPy arrays: an .npz holding an event_uid array and the score arrays,
+// or a score .npy whose uids are in <stem>_event_uid.npy next to it. Float32/float64 arrays
+// are score columns named after the array: one-dimensional arrays give scalar columns, and
+// two-dimensional ones a vector column holding each event's row.
+ScoreTable readNumpyShard(const std::string &file_path, const std::vector<ColumnOverride> &overrides) {
+    std::vector<std::unique_ptr<MappedFile>> mappings;
+    std::map<std::string, NpyArray> arrays;
+    const std::filesystem::path path(file_path);
+    if (path.extension() == ".npz") {
+        mappings.push_back(std::make_unique<MappedFile>(file_path));
+        arrays = parseNpz(*mappings.back(), file_path);
+    } else {
+        const auto uid_path = (path.parent_path() / (path.stem().string() + "_event_uid.npy")).string();
+        mappings.push_back(std::make_unique<MappedFile>(file_path));
+        arrays.emplace(path.stem().string(),
+                       parseNpy(mappings.back()->data(), mappings.back()->size(), file_path));
+        mappings.push_back(std::make_unique<MappedFile>(uid_path));
+        arrays.emplace("event_uid", parseNpy(mappings.back()->data(), mappings.back()->size(), uid_path));
+    }
+
+    const auto uid_it = arrays.find("event_uid");
+    if (uid_it == arrays.end()) {
+        throw std::runtime_error(file_path + " has no event_uid array");
+    }
+    const NpyArray &uid_array = uid_it->second;
+    static const std::set<std::string> kUidTypes{"<u8", "<i8", "<u4", "<i4"};
+    if (uid_array.columns != 1 || kUidTypes.count(uid_array.descr) == 0U) {
+        throw std::runtime_error(file_path + ": event_uid must be a one-dimensional integer array, not " +
+                                 uid_array.descr);
+    }
+
+    std::map<std::string, const NpyArray *> available;
+    for (const auto &[name, array] : arrays) {
+        if (name == "event_uid" || (array.descr != "<f4" && array.descr != "<f8")) {
+            continue;
+        }
+        if (array.rows != uid_array.rows) {
+            throw std::runtime_error(file_path + ": " + name + " has " + std::to_string(array.rows) +
+                                     " rows but event_uid has " + std::to_string(uid_array.rows));
         }
+        available.emplace(name, &array);
+    }
 
-        auto [it, inserted] = table.values.emplace(uid, std::vector<double>{});
-        if (!inserted) {
-            ++table.duplicate_uids;
+    ScoreTable table;
+    std::vector<const NpyArray *> sources;
+    auto addColumn = [&](const std::string &input, const std::string &output) {
+        const auto it = available.find(input);
+        if (it == available.end()) {
+            throw std::runtime_error("Score column '" + input + "' was not found in " + file_path);
+        }
+        const NpyArray &array = *it->second;
+        ColumnSpec spec;
+        spec.input_name = input;
+        spec.output_name = output;
+        const bool single = array.descr == "<f4";
+        spec.leaf_type = single ? kFloat_t : kDouble_t;
+        if (array.matrix) {
+            spec.value_type = ColumnSpec::ValueType::FloatVector;
+            spec.width = array.columns;
+        } else {
+            spec.value_type = single ? ColumnSpec::ValueType::Float : ColumnSpec::ValueType::Double;
+        }
+        table.columns.push_back(std::move(spec));
+        sources.push_back(&array);
+    };
+    if (overrides.empty()) {
+        for (const auto &[name, array] : available) {
+            addColumn(name, name);
+        }
+    } else {
+        for (const auto &[input, output] : overrides) {
+            addColumn(input, output);
         }
-        it->second = std::move(row);
-        ++table.total_rows;
+    }
+    if (table.columns.empty()) {
+        throw std::runtime_error("No score columns were selected for attachment");
     }
 
+    // The mapping is read once, straight into the column arrays; no intermediate buffers.
+    const std::size_t rows = uid_array.rows;
+    table.uids.resize(rows);
+    const bool wide_uids = uid_array.itemSize() == sizeof(ULong64_t);
+    for (std::size_t row = 0; row < rows; ++row) {
+        table.uids[row] = wide_uids ? uid_array.at<ULong64_t>(row, 0) : uid_array.at<UInt_t>(row, 0);
+    }
+    for (std::size_t idx = 0; idx < table.columns.size(); ++idx) {
+        auto &spec = table.columns[idx];
+        const NpyArray &array = *sources[idx];
+        if (spec.value_type == ColumnSpec::ValueType::Float) {
+            spec.slot = table.floats.size();
+            auto &values = table.floats.emplace_back(rows);
+            for (std::size_t row = 0; row < rows; ++row) {
+                values[row] = array.at<float>(row, 0);
+            }
+        } else if (spec.value_type == ColumnSpec::ValueType::Double) {
+            spec.slot = table.doubles.size();
+            auto &values = table.doubles.emplace_back(rows);
+            for (std::size_t row = 0; row < rows; ++row) {
+                values[row] = array.at<double>(row, 0);
+            }
+        } else {
+            // A C-ordered float32 matrix already has the table's layout.
+            spec.slot = table.vectors.size();
+            auto &values = table.vectors.emplace_back(rows * spec.width);
+            if (spec.leaf_type == kFloat_t && !array.fortran_order) {
+                std::memcpy(values.data(), array.data, values.size() * sizeof(float));
+                continue;
+            }
+            for (std::size_t row = 0; row < rows; ++row) {
+                for (std::size_t column = 0; column < spec.width; ++column) {
+                    values[row * spec.width + column] = spec.leaf_type == kFloat_t
+                                                            ? array.at<float>(row, column)
+                                                            : static_cast<float>(array.at<double>(row, column));
+                }
+            }
+        }
+    }
+    table.total_rows = rows;
     return table;
 }
 
+template <typename T>
+void append(std::vector<T> &target, std::vector<T> &&source) {
+    if (target.empty()) {
+        target = std::move(source);
+    } else {
+        target.insert(target.end(), source.begin(), source.end());
+    }
+}
+
+// Reads the shards on up to `threads` threads and merges them, in the order given, into one
+// sorted table. Every shard must provide the same score columns.
+ScoreTable loadScoreTable(const std::vector<std::string> &file_paths, const std::string &tree_name,
+                          const std::vector<ColumnOverride> &overrides, DuplicatePolicy policy,
+                          std::size_t threads) {
+    std::vector<ScoreTable> shards(file_paths.size());
+    std::atomic<std::size_t> next{0};
+    std::mutex error_mutex;
+    std::exception_ptr error;
+    auto work = [&]() {
+        for (std::size_t idx = next++; idx < file_paths.size(); idx = next++) {
+            try {
+                shards[idx] = isNumpyInput(file_paths[idx]) ? readNumpyShard(file_paths[idx], overrides)
+                                                            : readScoreShard(file_paths[idx], tree_name, overrides);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                next = file_paths.size();
+            }
+        }
+    };
+    ROOT::EnableThreadSafety();
+    const std::size_t n_threads = std::max<std::size_t>(1, std::min(threads, file_paths.size()));
+    std::vector<std::thread> workers;
+    for (std::size_t i = 1; i < n_threads; ++i) {
+        workers.emplace_back(work);
+    }
+    work();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+
+    ScoreTable table = std::move(shards.front());
+    for (std::size_t idx = 1; idx < shards.size(); ++idx) {
+        auto &shard = shards[idx];
+        const bool same_columns = std::equal(
+            table.columns.begin(), table.columns.end(), shard.columns.begin(), shard.columns.end(),
+            [](const ColumnSpec &a, const ColumnSpec &b) {
+                // A shard without rows has not seen the width of a variable-length column.
+                return a.output_name == b.output_name && a.value_type == b.value_type &&
+                       (a.width == b.width || a.width == 0 || b.width == 0);
+            });
+        if (!same_columns) {
+            throw std::runtime_error("Score shard " + file_paths[idx] + " does not provide the same columns as " +
+                                     file_paths.front());
+        }
+        for (std::size_t column = 0; column < table.columns.size(); ++column) {
+            table.columns[column].width = std::max(table.columns[column].width, shard.columns[column].width);
+        }
+        append(table.uids, std::move(shard.uids));
+        for (std::size_t slot = 0; slot < table.floats.size(); ++slot) {
+            append(table.floats[slot], std::move(shard.floats[slot]));
+        }
+        for (std::size_t slot = 0; slot < table.doubles.size(); ++slot) {
+            append(table.doubles[slot], std::move(shard.doubles[slot]));
+        }
+        for (std::size_t slot = 0; slot < table.vectors.size(); ++slot) {
+            append(table.vectors[slot], std::move(shard.vectors[slot]));
+        }
+        table.total_rows += shard.total_rows;
+        shard = ScoreTable{};
+    }
+    sortScoreTable(table, policy);
+    return table;
+}
+
+bool hasGlobCharacters(const std::string &value) { return value.find_first_of("*?[") != std::string::npos; }
+
+// --scores accepts a file, a glob over file names (the directory part is taken literally) or
+// a .txt/.list file naming one score file per line. Matches are returned sorted.
+// The <stem>_event_uid.npy files that carry the uids of a score .npy. They are read with their
+// score array, never as score shards of their own.
+bool isUidCompanion(const std::filesystem::path &path) {
+    const std::string suffix = "_event_uid.npy";
+    const auto name = path.filename().string();
+    return name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+std::vector<std::string> resolveScoreInputs(const std::string &spec) {
+    const std::filesystem::path path(spec);
+    std::vector<std::string> inputs;
+    if (hasGlobCharacters(path.filename().string())) {
+        const auto directory = path.has_parent_path() ? path.parent_path() : std::filesystem::path{"."};
+        const auto pattern = path.filename().string();
+        std::error_code ec;
+        for (std::filesystem::directory_iterator it(directory, ec), end; !ec && it != end; it.increment(ec)) {
+            if (it->is_regular_file(ec) && !isUidCompanion(it->path()) &&
+                ::fnmatch(pattern.c_str(), it->path().filename().c_str(), 0) == 0) {
+                inputs.push_back(it->path().string());
+            }
+        }
+        std::sort(inputs.begin(), inputs.end());
+        if (inputs.empty()) {
+            throw std::runtime_error("No score files match " + spec);
+        }
+    } else if (path.extension() == ".txt" || path.extension() == ".list") {
+        std::ifstream list(spec);
+        if (!list) {
+            throw std::runtime_error("Failed to open score file list: " + spec);
+        }
+        std::string line;
+        while (std::getline(list, line)) {
+            line = trim(line);
+            if (line.empty() || line.front() == '#') {
+                continue;
+            }
+            std::filesystem::path entry(line);
+            if (entry.is_relative() && path.has_parent_path()) {
+                entry = path.parent_path() / entry;
+            }
+            if (isUidCompanion(entry)) {
+                continue;
+            }
+            inputs.push_back(entry.string());
+        }
+        if (inputs.empty()) {
+            throw std::runtime_error("Score file list " + spec + " names no files");
+        }
+    } else {
+        inputs.push_back(spec);
+    }
+    return inputs;
+}
+
+// True when event_uid strictly increases along the score tree, which is what the streaming
+// join needs. Only the uid branch is read.
+bool scoresSortedByUid(const std::string &file_path, const std::string &tree_name) {
+    TFile score_file(file_path.c_str(), "READ");
+    auto *tree = findScoreTree(score_file, file_path, tree_name);
+    TTreeReader reader(tree);
+    auto event_reader = buildEventReader(reader, getLeafType(tree->GetLeaf("event_uid")));
+    bool first = true;
+    ULong64_t previous = 0ULL;
+    while (reader.Next()) {
+        const auto uid = event_reader->value();
+        if (!first && uid <= previous) {
+            return false;
+        }
+        previous = uid;
+        first = false;
+    }
+    return true;
+}
+
+// Merge-join cursor over a uid-sorted score tree, advanced by one entry's sequential event
+// loop. Only the baskets under the cursor are held in memory. A uid behind the cursor (an
+// entry whose events are not uid-ordered) is found again by binary search over the uid
+// branch, so the join stays correct and only gets slower.
+class ScoreStream {
+  public:
+    ScoreStream(const std::string &file_path, const std::string &tree_name,
+                const std::vector<ColumnOverride> &overrides)
+        : file_(file_path.c_str(), "READ"),
+          tree_(findScoreTree(file_, file_path, tree_name)),
+          columns_(selectScoreColumns(tree_, overrides)),
+          reader_(tree_),
+          event_reader_(buildEventReader(reader_, getLeafType(tree_->GetLeaf("event_uid")))),
+          entries_(tree_->GetEntries()) {
+        column_readers_.resize(columns_.size());
+        array_readers_.resize(columns_.size());
+        for (std::size_t idx = 0; idx < columns_.size(); ++idx) {
+            if (columns_[idx].value_type == ColumnSpec::ValueType::FloatVector) {
+                array_readers_[idx] = buildArrayReader(reader_, columns_[idx]);
+            } else {
+                column_readers_[idx] = buildColumnReader(reader_, columns_[idx]);
+            }
+        }
+        if (entries_ > 0) {
+            // Variable-length vector columns take their width from the first row.
+            reader_.SetEntry(0);
+            for (std::size_t idx = 0; idx < columns_.size(); ++idx) {
+                if (array_readers_[idx]) {
+                    checkVectorWidth(columns_[idx], array_readers_[idx]->size(), true);
+                }
+            }
+            reader_.SetEntry(entries_ - 1);
+            last_uid_ = event_reader_->value();
+        }
+    }
+
+    const std::vector<ColumnSpec> &columns() const noexcept { return columns_; }
+    std::size_t reseeks() const noexcept { return reseeks_; }
+
+    // Moves the cursor to uid and reports whether the tree has a row for it.
+    bool seek(ULong64_t uid) {
+        if (row_ < 0 || uid < uid_) {
+            if (row_ >= 0) {
+                ++reseeks_;
+            }
+            moveTo(lowerBound(uid));
+        }
+        while (row_ < entries_ && uid_ < uid) {
+            moveTo(row_ + 1);
+        }
+        return row_ < entries_ && uid_ == uid;
+    }
+
+    // Score of a column at the cursor; only valid after seek() returned true.
+    double value(std::size_t column) { return column_readers_[column]->value(); }
+
+    // Scores of a vector column at the cursor; only valid after seek() returned true.
+    ROOT::RVec<float> values(std::size_t column) {
+        auto &spec = columns_[column];
+        checkVectorWidth(spec, array_readers_[column]->size(), false);
+        ROOT::RVec<float> out(spec.width);
+        array_readers_[column]->read(out.data());
+        return out;
+    }
+
+  private:
+    ULong64_t uidAt(Long64_t row) {
+        reader_.SetEntry(row);
+        return event_reader_->value();
+    }
+
+    void moveTo(Long64_t row) {
+        row_ = row;
+        uid_ = row_ < entries_ ? uidAt(row_) : last_uid_;
+    }
+
+    Long64_t lowerBound(ULong64_t uid) {
+        Long64_t low = 0;
+        Long64_t high = entries_;
+        while (low < high) {
+            const Long64_t mid = low + (high - low) / 2;
+            if (uidAt(mid) < uid) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        return low;
+    }
+
+    TFile file_;
+    TTree *tree_;
+    std::vector<ColumnSpec> columns_;
+    TTreeReader reader_;
+    std::unique_ptr<EventReaderBase> event_reader_;
+    std::vector<std::unique_ptr<ColumnReaderBase>> column_readers_;
+    std::vector<std::unique_ptr<ArrayReaderBase>> array_readers_;
+    Long64_t entries_;
+    Long64_t row_ = -1;
+    ULong64_t uid_ = 0ULL;
+    ULong64_t last_uid_ = 0ULL;
+    std::size_t reseeks_ = 0;
+};
+
+// Lookups are confined to the slice of the entry's uid range; matched counts the events that
+// found a row.
+ROOT::RDF::RNode defineIndexedScores(ROOT::RDF::RNode df, const std::shared_ptr<const ScoreTable> &table,
+                                     const ScoreTable::Slice &range,
+                                     const std::shared_ptr<std::atomic<std::size_t>> &matched) {
+    ROOT::RDF::RNode node = df.Define(kScoreRowColumn,
+                                      [table, range, matched](ULong64_t uid) {
+                                          const auto row = table->find(uid, range);
+                                          if (row >= 0) {
+                                              matched->fetch_add(1, std::memory_order_relaxed);
+                                          }
+                                          return row;
+                                      },
+                                      {"event_uid"});
+    for (const auto &column : table->columns) {
+        if (column.value_type == ColumnSpec::ValueType::Float) {
+            node = node.Define(column.output_name,
+                               [table, slot = column.slot](Long64_t row) {
+                                   return row < 0 ? std::numeric_limits<float>::quiet_NaN()
+                                                  : table->floats[slot][static_cast<std::size_t>(row)];
+                               },
+                               {kScoreRowColumn});
+        } else if (column.value_type == ColumnSpec::ValueType::Double) {
+            node = node.Define(column.output_name,
+                               [table, slot = column.slot](Long64_t row) {
+                                   return row < 0 ? std::numeric_limits<double>::quiet_NaN()
+                                                  : table->doubles[slot][static_cast<std::size_t>(row)];
+                               },
+                               {kScoreRowColumn});
+        } else {
+            node = node.Define(column.output_name,
+                               [table, slot = column.slot, width = column.width](Long64_t row) {
+                                   if (row < 0) {
+                                       return ROOT::RVec<float>(width, std::numeric_limits<float>::quiet_NaN());
+                                   }
+                                   const auto offset = static_cast<std::size_t>(row) * width;
+                                   const auto *first = table->vectors[slot].data() + offset;
+                                   return ROOT::RVec<float>(first, first + width);
+                               },
+                               {kScoreRowColumn});
+        }
+    }
+    return node;
+}
+
+// The stream is stateful, so the node must be run by a single-threaded event loop.
+ROOT::RDF::RNode defineStreamedScores(ROOT::RDF::RNode df, const std::shared_ptr<ScoreStream> &stream) {
+    ROOT::RDF::RNode node =
+        df.Define(kScoreMatchColumn, [stream](ULong64_t uid) { return stream->seek(uid); }, {"event_uid"});
+    const auto &columns = stream->columns();
+    for (std::size_t idx = 0; idx < columns.size(); ++idx) {
+        if (columns[idx].value_type == ColumnSpec::ValueType::Float) {
+            node = node.Define(columns[idx].output_name,
+                               [stream, idx](bool matched) {
+                                   return matched ? static_cast<float>(stream->value(idx))
+                                                  : std::numeric_limits<float>::quiet_NaN();
+                               },
+                               {kScoreMatchColumn});
+        } else if (columns[idx].value_type == ColumnSpec::ValueType::Double) {
+            node = node.Define(columns[idx].output_name,
+                               [stream, idx](bool matched) {
+                                   return matched ? stream->value(idx) : std::numeric_limits<double>::quiet_NaN();
+                               },
+                               {kScoreMatchColumn});
+        } else {
+            node = node.Define(columns[idx].output_name,
+                               [stream, idx, width = columns[idx].width](bool matched) {
+                                   return matched ? stream->values(idx)
+                                                  : ROOT::RVec<float>(width, std::numeric_limits<float>::quiet_NaN());
+                               },
+                               {kScoreMatchColumn});
+        }
+    }
+    return node;
+}
+
 std::string buildSamplePrefix(const proc::HubDataFrame::CatalogEntry &entry) {
     std::vector<std::string> components;
     components.push_back(sanitiseComponent(entry.sample_key.empty() ? std::string{"sample"} : entry.sample_key));
@@ -527,84 +1558,321 @@ std::filesystem::path makeRelativeToHub(const std::filesystem::path &path,
     return path;
 }
 
-void attachScores(const Options &opts) {
-    if (opts.hub_path.empty() || opts.scores_path.empty() || opts.scores_tree.empty() || opts.label.empty()) {
-        throw std::runtime_error("--hub, --scores, --tree, and --label are required arguments");
+// A score source ready to attach: its friend naming and either the loaded table or the
+// file each entry streams.
+struct SourceJob {
+    const ScoreSource *source;
+    std::filesystem::path output_dir;
+    std::string friend_label;
+    std::string friend_tree_name;
+    std::vector<std::string> friend_columns;
+    std::shared_ptr<const ScoreTable> table;
+    // Score file merge-joined by each entry; empty when the table is used.
+    std::string stream_path;
+};
+
+struct AttachJob {
+    const Options &opts;
+    std::filesystem::path hub_dir;
+    std::vector<SourceJob> sources;
+};
+
+// Catalog changes for one chain and source: a new friend row per chained entry, or refreshed
+// integrity records for a friend file rewritten in place.
+struct AttachResult {
+    std::vector<proc::HubFriend> new_friends;
+    std::vector<proc::HubFriendRelocation> rewritten_friends;
+    // Score rows inside the chain's uid range that no event matched (indexed table only).
+    std::size_t unmatched_scores = 0;
+};
+
+// Writes every source's friend for the chain that entry's selection loads, from one event
+// loop. chain lists the entries that dataframe covers, in row order; each gets its slice of
+// the one friend file. Sources define their columns on their own branch of the dataframe,
+// so they may share column names.
+std::vector<AttachResult> attachEntry(proc::HubDataFrame &hub, const proc::HubDataFrame::CatalogEntry &entry,
+                                      const std::vector<const proc::HubDataFrame::CatalogEntry *> &chain,
+                                      const AttachJob &job) {
+    const auto &opts = job.opts;
+
+    proc::HubDataFrame::Selection selection = hub.select();
+    selection.sample(entry.sample_key)
+        .beam(entry.beam)
+        .period(entry.period)
+        .variation(entry.variation)
+        .origin(entry.origin)
+        .stage(entry.stage);
+    auto df = selection.load();
+
+    // The dataframe spans every entry the selection chains (a compacted group loads whole), so
+    // the score lookup covers the union of their uid ranges. Hubs that predate the uid summary
+    // leave a range empty; those search every row.
+    bool bounded = !chain.empty();
+    ULong64_t first_uid = std::numeric_limits<ULong64_t>::max();
+    ULong64_t last_uid = 0ULL;
+    for (const auto *member : chain) {
+        if (member->last_event_uid < member->first_event_uid || member->last_event_uid == 0ULL) {
+            bounded = false;
+            break;
+        }
+        first_uid = std::min<ULong64_t>(first_uid, member->first_event_uid);
+        last_uid = std::max<ULong64_t>(last_uid, member->last_event_uid);
     }
 
-    const std::filesystem::path hub_path = std::filesystem::absolute(opts.hub_path);
-    const std::filesystem::path hub_dir = hub_path.parent_path();
+    proc::FriendWriter::ClusterBoundaries clusters;
+    if (opts.align_clusters) {
+        clusters = proc::FriendWriter::inputClusters(selection.datasetTrees());
+    }
+
+    struct Attachment {
+        std::string tree_name;
+        // Set when the chain's entries already share a friend file for the label.
+        std::string existing_path;
+        std::shared_ptr<ScoreStream> stream;
+        ScoreTable::Slice range;
+        std::shared_ptr<std::atomic<std::size_t>> matched = std::make_shared<std::atomic<std::size_t>>(0);
+    };
+    std::vector<Attachment> attachments(job.sources.size());
+    std::vector<proc::FriendWriter> writers;
+    writers.reserve(job.sources.size());
+    std::vector<proc::FriendWriter::FriendTarget> targets;
+    for (std::size_t idx = 0; idx < job.sources.size(); ++idx) {
+        const auto &source = job.sources[idx];
+        auto &attachment = attachments[idx];
+
+        // The one file written covers the whole chain, so an existing friend is rewritten in
+        // place only when every chained entry already shares it.
+        attachment.tree_name = source.friend_tree_name;
+        std::size_t with_friend = 0;
+        bool shared = true;
+        for (const auto *member : chain) {
+            auto existing_friend = std::find_if(member->friends.begin(), member->friends.end(),
+                                                [&](const proc::HubDataFrame::CatalogEntry::FriendInfo &info) {
+                                                    return info.label == source.friend_label && !info.path.empty();
+                                                });
+            if (existing_friend == member->friends.end()) {
+                continue;
+            }
+            if (with_friend++ == 0U) {
+                attachment.existing_path = existing_friend->path;
+                if (!existing_friend->tree.empty()) {
+                    attachment.tree_name = existing_friend->tree;
+                }
+            } else if (existing_friend->path != attachment.existing_path) {
+                shared = false;
+            }
+        }
+        if (with_friend != 0U && (with_friend != chain.size() || !shared)) {
+            throw std::runtime_error("Entries chained with " + entry.sample_key + " " + entry.variation +
+                                     " do not share one " + source.friend_label +
+                                     " friend file; remove or compact those friends first");
+        }
+        std::filesystem::path existing_path(attachment.existing_path);
+        if (!existing_path.empty() && !existing_path.is_absolute()) {
+            existing_path = job.hub_dir / existing_path;
+        }
+
+        ROOT::RDF::RNode node = df;
+        if (!source.stream_path.empty()) {
+            attachment.stream = std::make_shared<ScoreStream>(source.stream_path, source.source->scores_tree,
+                                                              source.source->column_overrides);
+            node = defineStreamedScores(df, attachment.stream);
+        } else {
+            attachment.range = bounded ? source.table->slice(first_uid, last_uid) : source.table->all();
+            node = defineIndexedScores(df, source.table, attachment.range, attachment.matched);
+        }
 
-    const std::string friend_label = sanitiseComponent(opts.label);
-    std::string friend_tree_name = opts.friend_tree.empty() ? friend_label : sanitiseComponent(opts.friend_tree);
-    if (friend_label != opts.label) {
-        proc::log::info("hub-attach-friends", "Friend label normalised to", friend_label);
+        proc::FriendWriter::FriendConfig config;
+        config.output_dir = source.output_dir;
+        config.tree_name = attachment.tree_name;
+        config.output_format = opts.format;
+        const auto &writer = writers.emplace_back(config);
+
+        const auto path = !existing_path.empty()
+                              ? existing_path
+                              : writer.generateFriendPath(buildSamplePrefix(entry),
+                                                          buildVariationTag(entry, source.friend_label));
+        targets.push_back(proc::FriendWriter::FriendTarget{node, &writer, path, source.friend_columns});
     }
-    if (!opts.friend_tree.empty() && friend_tree_name != opts.friend_tree) {
-        proc::log::info("hub-attach-friends", "Friend tree name normalised to", friend_tree_name);
+
+    proc::FriendWriter::writeFriends(targets, clusters);
+
+    std::vector<AttachResult> results(job.sources.size());
+    for (std::size_t idx = 0; idx < job.sources.size(); ++idx) {
+        const auto &source = job.sources[idx];
+        const auto &attachment = attachments[idx];
+        const auto &written_path = targets[idx].path;
+
+        proc::log::info("hub-attach-friends", "Attached", source.friend_label, "for", entry.sample_key,
+                        entry.variation, "->", written_path.string());
+        if (attachment.stream && attachment.stream->reseeks() > 0) {
+            proc::log::info("hub-attach-friends", "[warning]", entry.sample_key, entry.variation,
+                            "is not ordered by event_uid; the streaming join searched the", source.friend_label,
+                            "scores", attachment.stream->reseeks(), "times");
+        }
+
+        auto &result = results[idx];
+        if (!attachment.stream) {
+            const auto &range = attachment.range;
+            result.unmatched_scores = range.size() - std::min(range.size(), attachment.matched->load());
+            if (result.unmatched_scores > 0) {
+                proc::log::info("hub-attach-friends", "[debug]", entry.sample_key, entry.variation, ":",
+                                result.unmatched_scores, "of", range.size(), source.friend_label,
+                                "score rows in the loaded uid range matched no event");
+            }
+        }
+        // Rows follow the chain, so each entry starts where the previous ones end.
+        const ULong64_t written_bytes = std::filesystem::file_size(written_path);
+        const ULong64_t written_checksum = proc::fileChecksum(written_path.string());
+        Long64_t offset = 0;
+        for (const auto *member : chain) {
+            const auto rows = static_cast<Long64_t>(member->n_events);
+            if (attachment.existing_path.empty()) {
+                proc::HubFriend friend_entry;
+                friend_entry.entry_id = member->entry_id;
+                friend_entry.label = source.friend_label;
+                friend_entry.tree = attachment.tree_name;
+                friend_entry.path = makeRelativeToHub(written_path, job.hub_dir).generic_string();
+                friend_entry.format = proc::friendFormatName(opts.format);
+                friend_entry.entry_offset = offset;
+                friend_entry.n_entries = rows;
+                friend_entry.file_bytes = written_bytes;
+                friend_entry.checksum = written_checksum;
+                result.new_friends.push_back(std::move(friend_entry));
+            } else {
+                // The file was rewritten in place, so its recorded size and checksum are stale.
+                result.rewritten_friends.push_back(proc::HubFriendRelocation{
+                    member->entry_id, source.friend_label, attachment.existing_path, offset, rows, written_bytes,
+                    written_checksum});
+            }
+            offset += rows;
+        }
     }
+    return results;
+}
 
-    std::filesystem::path output_dir = opts.output_dir;
-    if (output_dir.empty()) {
-        output_dir = hub_dir / "friends" / friend_label;
-    } else if (!output_dir.is_absolute()) {
-        output_dir = hub_dir / output_dir;
+// Resolves a source's friend naming and loads its score table, or picks the file to stream.
+SourceJob prepareSource(const Options &opts, const ScoreSource &source, const std::filesystem::path &hub_dir) {
+    const auto score_inputs = resolveScoreInputs(source.scores_path);
+
+    SourceJob job;
+    job.source = &source;
+    job.friend_label = sanitiseComponent(source.label);
+    job.friend_tree_name = source.friend_tree.empty() ? job.friend_label : sanitiseComponent(source.friend_tree);
+    if (job.friend_label != source.label) {
+        proc::log::info("hub-attach-friends", "Friend label normalised to", job.friend_label);
+    }
+    if (!source.friend_tree.empty() && job.friend_tree_name != source.friend_tree) {
+        proc::log::info("hub-attach-friends", "Friend tree name normalised to", job.friend_tree_name);
     }
 
-    proc::log::info("hub-attach-friends", "Loading score table from", opts.scores_path, "tree", opts.scores_tree);
-    auto score_table = loadScoreTable(opts.scores_path, opts.scores_tree, opts.column_overrides);
-    proc::log::info("hub-attach-friends", "Loaded", score_table.total_rows, "score rows covering", score_table.values.size(),
-                    "unique events");
-    if (score_table.duplicate_uids > 0) {
-        proc::log::info("hub-attach-friends", "[warning]", score_table.duplicate_uids,
-                        "duplicate event_uid entries were replaced by the most recent values");
+    job.output_dir = source.output_dir;
+    if (job.output_dir.empty()) {
+        job.output_dir = hub_dir / "friends" / job.friend_label;
+    } else if (!job.output_dir.is_absolute()) {
+        job.output_dir = hub_dir / job.output_dir;
     }
 
-    if (score_table.values.empty()) {
-        throw std::runtime_error("Score table is empty; nothing to attach");
+    bool streaming = false;
+    if (opts.streaming) {
+        if (ROOT::IsImplicitMTEnabled()) {
+            proc::log::info("hub-attach-friends", "[warning]",
+                            "Streaming needs sequential event loops; loading the score table instead");
+        } else if (isNumpyInput(score_inputs.front())) {
+            proc::log::info("hub-attach-friends", "[warning]",
+                            "Streaming reads a score tree; loading the NumPy arrays instead");
+        } else if (score_inputs.size() > 1U) {
+            proc::log::info("hub-attach-friends", "[warning]",
+                            "Streaming reads a single score file; loading the", score_inputs.size(), "shards instead");
+        } else if (scoresSortedByUid(score_inputs.front(), source.scores_tree)) {
+            streaming = true;
+        } else {
+            proc::log::info("hub-attach-friends", "[warning]",
+                            "Score tree is not strictly sorted by event_uid; loading the score table instead");
+        }
     }
 
-    proc::HubDataFrame hub(opts.hub_path);
+    std::vector<ColumnSpec> score_columns;
+    if (streaming) {
+        ScoreStream probe(score_inputs.front(), source.scores_tree, source.column_overrides);
+        score_columns = probe.columns();
+        job.stream_path = score_inputs.front();
+        proc::log::info("hub-attach-friends", "Streaming uid-sorted", job.friend_label, "scores from",
+                        score_inputs.front(), "tree", source.scores_tree);
+    } else {
+        proc::log::info("hub-attach-friends", "Loading", job.friend_label, "score table from", score_inputs.size(),
+                        "file(s) matching", source.scores_path, "tree", source.scores_tree);
+        auto score_table = loadScoreTable(score_inputs, source.scores_tree, source.column_overrides,
+                                          opts.duplicates, opts.threads);
+        proc::log::info("hub-attach-friends", "Loaded", score_table.total_rows, "score rows covering",
+                        score_table.uids.size(), "unique events");
+        if (score_table.duplicate_uids > 0) {
+            proc::log::info("hub-attach-friends", "[warning]", score_table.duplicate_uids,
+                            "duplicate event_uid rows were resolved with the", duplicatePolicyName(opts.duplicates),
+                            "policy");
+        }
 
-    std::vector<std::string> friend_columns;
-    friend_columns.reserve(score_table.columns.size() + 1);
-    friend_columns.push_back("event_uid");
-    for (const auto &column : score_table.columns) {
-        friend_columns.push_back(column.output_name);
+        if (score_table.uids.empty()) {
+            throw std::runtime_error("Score table for " + job.friend_label + " is empty; nothing to attach");
+        }
+        score_columns = score_table.columns;
+        job.table = std::make_shared<const ScoreTable>(std::move(score_table));
+    }
+
+    job.friend_columns.reserve(score_columns.size() + 1);
+    job.friend_columns.push_back("event_uid");
+    for (const auto &column : score_columns) {
+        job.friend_columns.push_back(column.output_name);
     }
+    return job;
+}
 
-    auto lookup = std::make_shared<const std::unordered_map<ULong64_t, std::vector<double>>>(std::move(score_table.values));
+void attachScores(const Options &opts) {
+    if (opts.hub_path.empty() || opts.sources.empty()) {
+        throw std::runtime_error("--hub, --scores, and --label are required arguments");
+    }
+    std::unordered_set<std::string> labels;
+    for (const auto &source : opts.sources) {
+        if (source.scores_path.empty() || source.label.empty()) {
+            throw std::runtime_error("Every score source needs --scores and --label");
+        }
+        if (!labels.insert(sanitiseComponent(source.label)).second) {
+            throw std::runtime_error("Friend label " + source.label + " is given more than once");
+        }
+        const auto score_inputs = resolveScoreInputs(source.scores_path);
+        const bool numpy_only = std::all_of(score_inputs.begin(), score_inputs.end(),
+                                            [](const std::string &input) { return isNumpyInput(input); });
+        if (source.scores_tree.empty() && !numpy_only) {
+            throw std::runtime_error("--tree is required for ROOT score files (" + source.label + ")");
+        }
+    }
+    if (opts.format == proc::FriendFormat::kRNTuple) {
+        proc::log::info("hub-attach-friends", "[warning]",
+                        "RNTuple friends are not joined by HubDataFrame::load(); read them with Selection::loadFriend");
+    }
 
-    std::vector<proc::HubFriend> new_friend_entries;
-    new_friend_entries.reserve(hub.catalog().size());
+    const std::filesystem::path hub_path = std::filesystem::absolute(opts.hub_path);
+    const std::filesystem::path hub_dir = hub_path.parent_path();
 
-    const auto &entries = hub.catalog();
-    std::size_t updated_entries = 0;
+    AttachJob job{opts, hub_dir, {}};
+    for (const auto &source : opts.sources) {
+        job.sources.push_back(prepareSource(opts, source, hub_dir));
+    }
+
+    proc::HubDataFrame hub(opts.hub_path);
 
-    for (const auto &entry : entries) {
+    // One job per distinct chain: every entry an entry's selection loads shares that event
+    // loop and its friend file, so scheduling them separately would write the file twice at once.
+    struct ChainJob {
+        const proc::HubDataFrame::CatalogEntry *entry;
+        std::vector<const proc::HubDataFrame::CatalogEntry *> chain;
+    };
+    std::vector<ChainJob> pending;
+    std::set<std::vector<std::uint32_t>> scheduled;
+    for (const auto &entry : hub.catalog()) {
         if (entry.n_events == 0ULL) {
             continue;
         }
-
-        auto existing_friend = std::find_if(entry.friends.begin(), entry.friends.end(),
-                                            [&](const proc::HubDataFrame::CatalogEntry::FriendInfo &info) {
-                                                return info.label == friend_label;
-                                            });
-
-        std::string tree_name = friend_tree_name;
-        bool needs_metadata = true;
-        std::filesystem::path existing_path;
-        if (existing_friend != entry.friends.end()) {
-            tree_name = existing_friend->tree.empty() ? friend_tree_name : existing_friend->tree;
-            if (!existing_friend->path.empty()) {
-                existing_path = existing_friend->path;
-                if (!existing_path.is_absolute()) {
-                    existing_path = hub_dir / existing_path;
-                }
-                needs_metadata = false;
-            }
-        }
-
         proc::HubDataFrame::Selection selection = hub.select();
         selection.sample(entry.sample_key)
             .beam(entry.beam)
@@ -612,80 +1880,84 @@ void attachScores(const Options &opts) {
             .variation(entry.variation)
             .origin(entry.origin)
             .stage(entry.stage);
-        auto df = selection.load();
+        auto chain = selection.chainEntries();
+        std::vector<std::uint32_t> ids;
+        ids.reserve(chain.size());
+        for (const auto *member : chain) {
+            ids.push_back(member->entry_id);
+        }
+        std::sort(ids.begin(), ids.end());
+        if (scheduled.insert(std::move(ids)).second) {
+            pending.push_back(ChainJob{&entry, std::move(chain)});
+        }
+    }
 
-        ROOT::RDF::RNode node = df;
-        for (std::size_t idx = 0; idx < score_table.columns.size(); ++idx) {
-            const auto column = score_table.columns[idx];
-            if (column.value_type == ColumnSpec::ValueType::Float) {
-                const float missing = std::numeric_limits<float>::quiet_NaN();
-                node = node.Define(column.output_name,
-                                   [lookup, idx, missing](ULong64_t uid) -> float {
-                                       const auto it = lookup->find(uid);
-                                       if (it == lookup->end()) {
-                                           return missing;
-                                       }
-                                       const auto &row = it->second;
-                                       if (idx >= row.size()) {
-                                           return missing;
-                                       }
-                                       return static_cast<float>(row[idx]);
-                                   },
-                                   {"event_uid"});
-            } else {
-                const double missing = std::numeric_limits<double>::quiet_NaN();
-                node = node.Define(column.output_name,
-                                   [lookup, idx, missing](ULong64_t uid) -> double {
-                                       const auto it = lookup->find(uid);
-                                       if (it == lookup->end()) {
-                                           return missing;
-                                       }
-                                       const auto &row = it->second;
-                                       if (idx >= row.size()) {
-                                           return missing;
-                                       }
-                                       return row[idx];
-                                   },
-                                   {"event_uid"});
+    // Chains are independent: each has its own event loop and friend files, and the score
+    // tables are shared read-only. Catalog updates are gathered and written once below.
+    std::vector<std::vector<AttachResult>> results(pending.size());
+    std::atomic<std::size_t> next{0};
+    std::mutex error_mutex;
+    std::exception_ptr error;
+    auto work = [&]() {
+        for (std::size_t idx = next++; idx < pending.size(); idx = next++) {
+            try {
+                results[idx] = attachEntry(hub, *pending[idx].entry, pending[idx].chain, job);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                next = pending.size();
             }
         }
+    };
+    const std::size_t n_threads = std::max<std::size_t>(1, std::min(opts.threads, pending.size()));
+    proc::log::info("hub-attach-friends", "Attaching", job.sources.size(), "score source(s) to", pending.size(),
+                    "chains on", n_threads, "thread(s)");
+    std::vector<std::thread> workers;
+    for (std::size_t i = 1; i < n_threads; ++i) {
+        workers.emplace_back(work);
+    }
+    work();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
 
-        proc::FriendWriter::FriendConfig config;
-        config.output_dir = output_dir;
-        config.tree_name = tree_name;
-        proc::FriendWriter writer(config);
-
-        std::filesystem::path written_path;
-        if (!existing_path.empty()) {
-            written_path = writer.writeFriendToPath(node, existing_path, friend_columns);
-        } else {
-            const auto sample_prefix = buildSamplePrefix(entry);
-            const auto variation_tag = buildVariationTag(entry, friend_label);
-            written_path = writer.writeFriend(node, sample_prefix, variation_tag, friend_columns);
+    std::vector<proc::HubFriend> new_friend_entries;
+    std::vector<proc::HubFriendRelocation> rewritten_friends;
+    std::vector<std::size_t> unmatched_scores(job.sources.size(), 0);
+    std::vector<std::size_t> entries_with_unmatched(job.sources.size(), 0);
+    for (auto &entry_results : results) {
+        for (std::size_t idx = 0; idx < entry_results.size(); ++idx) {
+            auto &result = entry_results[idx];
+            std::move(result.new_friends.begin(), result.new_friends.end(), std::back_inserter(new_friend_entries));
+            std::move(result.rewritten_friends.begin(), result.rewritten_friends.end(),
+                      std::back_inserter(rewritten_friends));
+            unmatched_scores[idx] += result.unmatched_scores;
+            entries_with_unmatched[idx] += result.unmatched_scores > 0 ? 1U : 0U;
         }
-
-        proc::log::info("hub-attach-friends", "Attached", friend_label, "for", entry.sample_key, entry.variation,
-                        "->", written_path.string());
-        ++updated_entries;
-
-        if (needs_metadata) {
-            proc::HubFriend friend_entry;
-            friend_entry.entry_id = entry.entry_id;
-            friend_entry.label = friend_label;
-            friend_entry.tree = tree_name;
-            friend_entry.path = makeRelativeToHub(written_path, hub_dir).generic_string();
-            new_friend_entries.push_back(std::move(friend_entry));
+    }
+    for (std::size_t idx = 0; idx < job.sources.size(); ++idx) {
+        if (unmatched_scores[idx] > 0) {
+            proc::log::info("hub-attach-friends", "[warning]", unmatched_scores[idx], job.sources[idx].friend_label,
+                            "score rows across", entries_with_unmatched[idx],
+                            "chains fall inside a chain's uid range but matched none of its events");
         }
     }
 
-    if (!new_friend_entries.empty()) {
+    if (!new_friend_entries.empty() || !rewritten_friends.empty()) {
         proc::log::info("hub-attach-friends", "Registering", new_friend_entries.size(),
                         "new friend metadata entries");
         proc::HubCatalog catalog(opts.hub_path, proc::HubCatalog::OpenMode::Update);
         catalog.addFriends(new_friend_entries);
+        catalog.relocateFriends(rewritten_friends);
     }
 
-    proc::log::info("hub-attach-friends", "Updated", updated_entries, "hub entries with", friend_label, "scores");
+    proc::log::info("hub-attach-friends", "Updated", new_friend_entries.size() + rewritten_friends.size(),
+                    "hub entry friends across", results.size(), "chains with", job.sources.size(), "score source(s)");
 }
 
 } // namespace
@@ -0,0 +1,336 @@
+#include <rarexsec/FriendWriter.h>
+#include <rarexsec/HubCatalog.h>
+#include <rarexsec/HubDataFrame.h>
+#include <rarexsec/LoggerUtils.h>
+
+#include "TFile.h"
+#include "TObjArray.h"
+#include "TTree.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace {
+
+using CatalogEntry = proc::HubDataFrame::CatalogEntry;
+using proc::sanitiseComponent;
+using GroupKey = std::tuple<std::string, std::string, std::string, std::string, std::string, std::string>;
+
+struct Options {
+    bool show_help = false;
+    bool dry_run = false;
+    bool remove_shards = false;
+    std::string hub_path;
+    std::filesystem::path output_dir;
+};
+
+void printUsage() {
+    std::cout << "Usage: hub-compact --hub <hub> [--output-dir <dir>] [--remove-shards] [--dry-run]" << std::endl;
+    std::cout << "\nMerges the per-entry friend shards of catalogue entries that share a sample, beam, period,"
+              << std::endl;
+    std::cout << "variation, origin and stage into one file per friend, copying compressed baskets without"
+              << std::endl;
+    std::cout << "re-encoding them, and records each entry's row offset in the hub." << std::endl;
+    std::cout << "\nOptions:" << std::endl;
+    std::cout << "  --hub            Path to the hub catalogue (.hub.root)" << std::endl;
+    std::cout << "  --output-dir     Directory for merged friends (default <hub dir>/friends/compact;" << std::endl;
+    std::cout << "                   relative paths are resolved against the hub)" << std::endl;
+    std::cout << "  --remove-shards  Delete the original shards once the hub points at the merged files" << std::endl;
+    std::cout << "  --dry-run        Report the groups that would be merged without writing anything" << std::endl;
+}
+
+Options parseOptions(int argc, char **argv) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            opts.show_help = true;
+            return opts;
+        }
+        auto require_value = [&](const char *name) -> std::string {
+            if (i + 1 >= argc) {
+                throw std::runtime_error(std::string{"Missing value for "} + name);
+            }
+            return std::string{argv[++i]};
+        };
+
+        if (arg == "--hub") {
+            opts.hub_path = require_value("--hub");
+        } else if (arg == "--output-dir") {
+            opts.output_dir = std::filesystem::path{require_value("--output-dir")};
+        } else if (arg == "--remove-shards") {
+            opts.remove_shards = true;
+        } else if (arg == "--dry-run") {
+            opts.dry_run = true;
+        } else {
+            throw std::runtime_error("Unrecognised option: " + arg);
+        }
+    }
+    return opts;
+}
+
+std::filesystem::path resolveAgainst(const std::string &path, const std::filesystem::path &hub_dir) {
+    std::filesystem::path resolved(path);
+    return resolved.is_relative() ? hub_dir / resolved : resolved;
+}
+
+std::filesystem::path makeRelativeToHub(const std::filesystem::path &path, const std::filesystem::path &hub_dir) {
+    std::error_code ec;
+    auto relative = std::filesystem::relative(path, hub_dir, ec);
+    return ec ? path : relative;
+}
+
+const CatalogEntry::FriendInfo *findFriend(const CatalogEntry &entry, const std::string &label) {
+    for (const auto &info : entry.friends) {
+        if (info.label == label) {
+            return &info;
+        }
+    }
+    return nullptr;
+}
+
+// Packed friends carry their uid index and layout as side tables that a basket copy would
+// not reproduce, so they are left as they are.
+bool isPacked(const std::filesystem::path &path, const std::string &tree_name) {
+    std::unique_ptr<TFile> file(TFile::Open(path.string().c_str(), "READ"));
+    return file && !file->IsZombie() &&
+           file->Get<TTree>(proc::FriendWriter::layoutTableName(tree_name).c_str()) != nullptr;
+}
+
+// A friend can be merged when every member has its own unpacked TTree shard for it. Entries
+// that already share a file (an earlier compaction) are left alone.
+std::vector<std::string> mergeableLabels(const std::vector<const CatalogEntry *> &members,
+                                         const std::filesystem::path &hub_dir) {
+    std::vector<std::string> labels;
+    for (const auto &info : members.front()->friends) {
+        bool mergeable = true;
+        std::set<std::string> paths;
+        for (const auto *member : members) {
+            const auto *other = findFriend(*member, info.label);
+            if (!other || other->path.empty() || other->tree != info.tree || other->entry_offset != 0ULL ||
+                (!other->format.empty() && other->format != proc::friendFormatName(proc::FriendFormat::kTTree)) ||
+                !paths.insert(other->path).second) {
+                mergeable = false;
+                break;
+            }
+        }
+        if (mergeable && !isPacked(resolveAgainst(info.path, hub_dir), info.tree)) {
+            labels.push_back(info.label);
+        }
+    }
+    // The primary friend decides the layout HubDataFrame expects, so it must be merged for
+    // any labelled friend to be.
+    if (std::find(labels.begin(), labels.end(), std::string{}) == labels.end()) {
+        labels.clear();
+    }
+    return labels;
+}
+
+std::vector<std::string> branchNames(TTree &tree) {
+    std::vector<std::string> names;
+    auto *branches = tree.GetListOfBranches();
+    names.reserve(static_cast<std::size_t>(branches->GetEntries()));
+    for (int i = 0; i < branches->GetEntries(); ++i) {
+        names.emplace_back(branches->At(i)->GetName());
+    }
+    return names;
+}
+
+// Concatenates the shards in member order and returns each member's first row.
+std::vector<Long64_t> mergeShards(const std::vector<std::filesystem::path> &shards,
+                                  const std::vector<const CatalogEntry *> &members, const std::string &tree_name,
+                                  const std::filesystem::path &output) {
+    const auto staging = output.string() + ".compact";
+    std::unique_ptr<TFile> out(TFile::Open(staging.c_str(), "RECREATE"));
+    if (!out || out->IsZombie()) {
+        throw std::runtime_error("Unable to create " + staging);
+    }
+
+    std::vector<Long64_t> offsets;
+    offsets.reserve(shards.size());
+    TTree *merged = nullptr;
+    Long64_t rows = 0;
+    for (std::size_t i = 0; i < shards.size(); ++i) {
+        std::unique_ptr<TFile> in(TFile::Open(shards[i].string().c_str(), "READ"));
+        auto *tree = (in && !in->IsZombie()) ? in->Get<TTree>(tree_name.c_str()) : nullptr;
+        if (!tree) {
+            throw std::runtime_error("Missing friend tree " + tree_name + " in " + shards[i].string());
+        }
+        if (members[i]->n_events > 0ULL && static_cast<ULong64_t>(tree->GetEntries()) != members[i]->n_events) {
+            throw std::runtime_error(shards[i].string() + " has " + std::to_string(tree->GetEntries()) +
+                                     " rows but its entry has " + std::to_string(members[i]->n_events) + " events");
+        }
+
+        offsets.push_back(rows);
+        out->cd();
+        if (!merged) {
+            // "fast" copies the compressed baskets as they are.
+            merged = tree->CloneTree(-1, "fast");
+        } else if (merged->CopyEntries(tree, -1, "fast") < 0) {
+            throw std::runtime_error("Failed to append " + shards[i].string());
+        }
+        rows += tree->GetEntries();
+    }
+
+    out->cd();
+    merged->Write(nullptr, TObject::kOverwrite);
+    out->Close();
+
+    std::error_code ec;
+    std::filesystem::rename(staging, output, ec);
+    if (ec) {
+        std::filesystem::remove(staging, ec);
+        throw std::runtime_error("Unable to move merged friend into place at " + output.string());
+    }
+    return offsets;
+}
+
+void rebuildSideTables(const std::filesystem::path &path, const std::string &tree_name) {
+    std::vector<std::string> columns;
+    {
+        std::unique_ptr<TFile> file(TFile::Open(path.string().c_str(), "READ"));
+        auto *tree = (file && !file->IsZombie()) ? file->Get<TTree>(tree_name.c_str()) : nullptr;
+        if (!tree) {
+            return;
+        }
+        columns = branchNames(*tree);
+    }
+    proc::FriendWriter::FriendConfig config;
+    config.output_dir = path.parent_path();
+    config.tree_name = tree_name;
+    proc::FriendWriter(config).writeSideTables(path, columns);
+}
+
+void compactHub(const Options &opts) {
+    if (opts.hub_path.empty()) {
+        throw std::runtime_error("--hub is required");
+    }
+
+    const std::filesystem::path hub_path = std::filesystem::absolute(opts.hub_path);
+    const std::filesystem::path hub_dir = hub_path.parent_path();
+    std::filesystem::path output_dir = opts.output_dir;
+    if (output_dir.empty()) {
+        output_dir = hub_dir / "friends" / "compact";
+    } else if (!output_dir.is_absolute()) {
+        output_dir = hub_dir / output_dir;
+    }
+
+    std::vector<proc::HubFriendRelocation> relocations;
+    std::vector<std::filesystem::path> merged_shards;
+    std::size_t merged_groups = 0;
+    {
+        proc::HubDataFrame hub(opts.hub_path);
+
+        std::map<GroupKey, std::vector<const CatalogEntry *>> groups;
+        for (const auto &entry : hub.catalog()) {
+            if (!entry.friend_path.empty()) {
+                groups[GroupKey{entry.sample_key, entry.beam, entry.period, entry.variation, entry.origin,
+                                entry.stage}]
+                    .push_back(&entry);
+            }
+        }
+
+        if (!opts.dry_run) {
+            std::filesystem::create_directories(output_dir);
+        }
+
+        for (const auto &[key, members] : groups) {
+            if (members.size() < 2U) {
+                continue;
+            }
+            const auto labels = mergeableLabels(members, hub_dir);
+            if (labels.empty()) {
+                proc::log::info("hub-compact", "[debug]", "Skipping", std::get<0>(key), std::get<3>(key),
+                                ": friends are not unpacked per-entry TTree shards");
+                continue;
+            }
+
+            const std::string stem = sanitiseComponent(std::get<0>(key)) + "_" + sanitiseComponent(std::get<1>(key)) +
+                                     "_" + sanitiseComponent(std::get<2>(key)) + "_" +
+                                     sanitiseComponent(std::get<3>(key)) + "_" + sanitiseComponent(std::get<4>(key)) +
+                                     "_" + sanitiseComponent(std::get<5>(key));
+            proc::log::info("hub-compact", "Merging", members.size(), "shards of", std::get<0>(key), std::get<3>(key),
+                            "for", labels.size(), "friend(s)");
+            if (opts.dry_run) {
+                ++merged_groups;
+                continue;
+            }
+
+            for (const auto &label : labels) {
+                const auto &tree_name = findFriend(*members.front(), label)->tree;
+                std::vector<std::filesystem::path> shards;
+                shards.reserve(members.size());
+                for (const auto *member : members) {
+                    shards.push_back(resolveAgainst(findFriend(*member, label)->path, hub_dir));
+                }
+
+                const auto output =
+                    output_dir / (stem + (label.empty() ? std::string{} : "_" + sanitiseComponent(label)) + ".root");
+                const auto offsets = mergeShards(shards, members, tree_name, output);
+                rebuildSideTables(output, tree_name);
+                const ULong64_t output_bytes = std::filesystem::file_size(output);
+                const ULong64_t output_checksum = proc::fileChecksum(output.string());
+
+                const auto stored_path = makeRelativeToHub(output, hub_dir).generic_string();
+                for (std::size_t i = 0; i < members.size(); ++i) {
+                    relocations.push_back(proc::HubFriendRelocation{members[i]->entry_id, label, stored_path,
+                                                                    offsets[i], -1, output_bytes, output_checksum});
+                }
+                merged_shards.insert(merged_shards.end(), shards.begin(), shards.end());
+            }
+            ++merged_groups;
+        }
+    }
+
+    if (opts.dry_run) {
+        proc::log::info("hub-compact", "Dry run:", merged_groups, "group(s) would be merged");
+        return;
+    }
+    if (relocations.empty()) {
+        proc::log::info("hub-compact", "Nothing to compact");
+        return;
+    }
+
+    {
+        proc::HubCatalog catalog(opts.hub_path, proc::HubCatalog::OpenMode::Update);
+        catalog.relocateFriends(relocations);
+        catalog.finalize();
+    }
+    proc::log::info("hub-compact", "Merged", merged_shards.size(), "shards into", merged_groups, "group(s)");
+
+    if (opts.remove_shards) {
+        for (const auto &shard : merged_shards) {
+            std::error_code ec;
+            if (!std::filesystem::remove(shard, ec) || ec) {
+                proc::log::info("hub-compact", "[warning]", "Unable to remove", shard.string());
+            }
+        }
+    }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    try {
+        auto options = parseOptions(argc, argv);
+        if (options.show_help) {
+            printUsage();
+            return 0;
+        }
+        compactHub(options);
+        return 0;
+    } catch (const std::exception &ex) {
+        std::cerr << "hub-compact: " << ex.what() << std::endl;
+        return 1;
+    }
+}
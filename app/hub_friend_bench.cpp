@@ -0,0 +1,447 @@
+#include <rarexsec/FriendWriter.h>
+#include <rarexsec/HubCatalog.h>
+#include <rarexsec/HubDataFrame.h>
+#include <rarexsec/LoggerUtils.h>
+
+#include <ROOT/RDataFrame.hxx>
+#include <ROOT/RResultHandle.hxx>
+#include <ROOT/RSnapshotOptions.hxx>
+#include <ROOT/RVec.hxx>
+#include <RVersion.h>
+#include "TChain.h"
+#include "TStopwatch.h"
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+namespace {
+
+struct Options {
+    bool show_help = false;
+    std::string hub_path;
+    std::filesystem::path output_dir{"friend_bench"};
+    std::size_t max_entries = 1;
+    std::size_t staging_threads = 1;
+};
+
+struct Measurement {
+    std::string format;
+    double write_seconds = 0.0;
+    double read_seconds = 0.0;
+    // Unset when the friend cannot be joined to the dataset chain (RNTuple, compacted files).
+    std::optional<double> joined_seconds;
+    std::uintmax_t bytes = 0;
+    unsigned long long events = 0;
+};
+
+// FriendWriter with inline compression against its write-behind staging. Staging reads the
+// uncompressed file back and writes the final one again; read_bytes and rewrite_bytes are
+// that I/O on top of the inline run's single write.
+struct StagingMeasurement {
+    std::string mode;
+    double loop_seconds = 0.0;
+    double total_seconds = 0.0;
+    std::uintmax_t peak_bytes = 0;
+    std::uintmax_t bytes = 0;
+    std::uintmax_t read_bytes = 0;
+    std::uintmax_t rewrite_bytes = 0;
+};
+
+// Polls the disk space (allocated blocks) of the files in a directory on a background thread,
+// keeping the peak growth over what was there at the start and the size of the largest new file.
+class DiskSampler {
+public:
+    explicit DiskSampler(std::filesystem::path dir) : dir_(std::move(dir)) {
+        baseline_ = scan(true);
+        thread_ = std::thread([this]() {
+            while (!stop_) {
+                scan(false);
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            }
+            scan(false);
+        });
+    }
+    ~DiskSampler() { stop(); }
+
+    void stop() {
+        if (thread_.joinable()) {
+            stop_ = true;
+            thread_.join();
+        }
+    }
+    std::uintmax_t peakBytes() const { return peak_ > baseline_ ? peak_ - baseline_ : 0U; }
+    std::uintmax_t largestFileBytes() const { return largest_file_; }
+
+private:
+    std::uintmax_t scan(bool baseline) {
+        std::uintmax_t total = 0;
+        std::error_code ec;
+        for (std::filesystem::directory_iterator it(dir_, ec), end; !ec && it != end; it.increment(ec)) {
+            struct stat info {};
+            if (::stat(it->path().c_str(), &info) != 0 || !S_ISREG(info.st_mode)) {
+                continue;
+            }
+            total += static_cast<std::uintmax_t>(info.st_blocks) * 512U;
+            if (baseline) {
+                existing_.insert(it->path().filename().string());
+            } else if (existing_.count(it->path().filename().string()) == 0U) {
+                largest_file_ = std::max(largest_file_, static_cast<std::uintmax_t>(info.st_size));
+            }
+        }
+        peak_ = std::max(peak_, total);
+        return total;
+    }
+
+    std::filesystem::path dir_;
+    std::set<std::string> existing_;
+    std::uintmax_t baseline_ = 0;
+    std::uintmax_t peak_ = 0;
+    std::uintmax_t largest_file_ = 0;
+    std::atomic<bool> stop_{false};
+    std::thread thread_;
+};
+
+void printUsage() {
+    std::cout << "Usage: hub-friend-bench --hub <hub> [--output-dir <dir>] [--entries <n>] [--staging-threads <n>]"
+              << std::endl;
+    std::cout << "\nRewrites the primary friend of the first catalogue entries as TTree and RNTuple and reports"
+              << std::endl;
+    std::cout << "snapshot throughput, file size, and the throughput of reading every column of the friend alone"
+              << std::endl;
+    std::cout << "and joined to its dataset tree. RNTuple friends cannot be joined to the dataset chain." << std::endl;
+    std::cout << "FriendWriter's inline compression is then compared with its write-behind staging: time spent in"
+              << std::endl;
+    std::cout << "the event loop, time until the friend is final, peak disk use sampled during the run, and the"
+              << std::endl;
+    std::cout << "extra I/O of staging: the uncompressed file read back and the final file written again." << std::endl;
+    std::cout << "\nOptions:" << std::endl;
+    std::cout << "  --hub           Path to the hub catalogue (.hub.root)" << std::endl;
+    std::cout << "  --output-dir    Scratch directory for the rewritten friends (default friend_bench)" << std::endl;
+    std::cout << "  --entries       Number of catalogue entries to benchmark (default 1)" << std::endl;
+    std::cout << "  --staging-threads Compression threads of the staged run (default 1; 0 skips it)" << std::endl;
+}
+
+Options parseOptions(int argc, char **argv) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            opts.show_help = true;
+            return opts;
+        }
+        auto require_value = [&](const char *name) -> std::string {
+            if (i + 1 >= argc) {
+                throw std::runtime_error(std::string{"Missing value for "} + name);
+            }
+            return std::string{argv[++i]};
+        };
+
+        if (arg == "--hub") {
+            opts.hub_path = require_value("--hub");
+        } else if (arg == "--output-dir") {
+            opts.output_dir = std::filesystem::path{require_value("--output-dir")};
+        } else if (arg == "--entries") {
+            opts.max_entries = static_cast<std::size_t>(std::stoul(require_value("--entries")));
+        } else if (arg == "--staging-threads") {
+            opts.staging_threads = static_cast<std::size_t>(std::stoul(require_value("--staging-threads")));
+        } else {
+            throw std::runtime_error("Unrecognised option: " + arg);
+        }
+    }
+    return opts;
+}
+
+// Calls visit with a null pointer to the arithmetic type named by type; false for other types.
+template <typename Visit>
+bool visitArithmetic(const std::string &type, Visit &&visit) {
+    if (type == "double" || type == "Double_t") {
+        visit(static_cast<double *>(nullptr));
+    } else if (type == "float" || type == "Float_t") {
+        visit(static_cast<float *>(nullptr));
+    } else if (type == "int" || type == "Int_t") {
+        visit(static_cast<int *>(nullptr));
+    } else if (type == "unsigned int" || type == "UInt_t") {
+        visit(static_cast<unsigned int *>(nullptr));
+    } else if (type == "short" || type == "Short_t") {
+        visit(static_cast<short *>(nullptr));
+    } else if (type == "unsigned short" || type == "UShort_t") {
+        visit(static_cast<unsigned short *>(nullptr));
+    } else if (type == "char" || type == "Char_t" || type == "signed char") {
+        visit(static_cast<Char_t *>(nullptr));
+    } else if (type == "unsigned char" || type == "UChar_t" || type == "std::uint8_t") {
+        visit(static_cast<UChar_t *>(nullptr));
+    } else if (type == "bool" || type == "Bool_t") {
+        visit(static_cast<bool *>(nullptr));
+    } else if (type == "Long64_t" || type == "long long" || type == "long" || type == "std::int64_t") {
+        visit(static_cast<Long64_t *>(nullptr));
+    } else if (type == "ULong64_t" || type == "unsigned long" || type == "unsigned long long" ||
+               type == "std::uint64_t") {
+        visit(static_cast<ULong64_t *>(nullptr));
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Element type of an RVec or std::vector column type; empty for scalars.
+std::string collectionElement(const std::string &type) {
+    if (type.find("RVec") == std::string::npos && type.find("vector") == std::string::npos) {
+        return {};
+    }
+    const auto open = type.find('<');
+    const auto close = type.rfind('>');
+    if (open != std::string::npos && close != std::string::npos && close > open) {
+        auto element = type.substr(open + 1, close - open - 1);
+        const auto begin = element.find_first_not_of(' ');
+        const auto end = element.find_last_not_of(' ');
+        return begin == std::string::npos ? std::string{} : element.substr(begin, end - begin + 1);
+    }
+    // Shorthands such as ROOT::RVecF.
+    static const std::vector<std::pair<std::string, std::string>> shorthands{
+        {"RVecF", "float"}, {"RVecD", "double"}, {"RVecI", "int"},       {"RVecU", "unsigned int"},
+        {"RVecB", "bool"},  {"RVecC", "char"},   {"RVecL", "Long64_t"}, {"RVecUL", "ULong64_t"}};
+    for (const auto &[suffix, element] : shorthands) {
+        if (type.size() >= suffix.size() && type.compare(type.size() - suffix.size(), suffix.size(), suffix) == 0) {
+            return element;
+        }
+    }
+    return {};
+}
+
+// Books a sum over every column, collections included, so that the read pass decompresses
+// and deserialises all of them. Columns of other types are reported rather than skipped silently.
+std::vector<ROOT::RDF::RResultHandle> bookReads(ROOT::RDF::RNode &df, const std::vector<std::string> &columns) {
+    std::vector<ROOT::RDF::RResultHandle> handles;
+    for (const auto &column : columns) {
+        const auto type = df.GetColumnType(column);
+        const auto element = collectionElement(type);
+        const bool booked =
+            element.empty() ? visitArithmetic(type,
+                                              [&](auto *tag) {
+                                                  using T = std::remove_pointer_t<decltype(tag)>;
+                                                  handles.emplace_back(df.Sum<T, double>(column));
+                                              })
+                            : visitArithmetic(element, [&](auto *tag) {
+                                  using T = std::remove_pointer_t<decltype(tag)>;
+                                  handles.emplace_back(df.Sum<ROOT::RVec<T>, double>(column));
+                              });
+        if (!booked) {
+            proc::log::info("hub-friend-bench", "[warning]", "Column", column, "of type", type, "is not read");
+        }
+    }
+    return handles;
+}
+
+// Reads every column and returns the event count and the wall time of the event loop.
+std::pair<unsigned long long, double> timeReads(ROOT::RDF::RNode df, const std::vector<std::string> &columns) {
+    auto count = df.Count();
+    auto handles = bookReads(df, columns);
+    handles.emplace_back(count);
+
+    TStopwatch watch;
+    watch.Start();
+    ROOT::RDF::RunGraphs(handles);
+    watch.Stop();
+    return {count.GetValue(), watch.RealTime()};
+}
+
+std::optional<Measurement> measure(const proc::HubDataFrame::CatalogEntry &entry, const std::filesystem::path &source,
+                                   const std::filesystem::path &dataset, proc::FriendFormat format,
+                                   const std::filesystem::path &output_dir) {
+    Measurement result;
+    result.format = proc::friendFormatName(format);
+
+    // The same plain snapshot for both formats, so neither pays for FriendWriter's side tables
+    // or rewrite passes. Codec and flush settings follow the FriendWriter defaults.
+    ROOT::RDF::RSnapshotOptions options;
+    options.fCompressionAlgorithm = ROOT::kZSTD;
+    options.fCompressionLevel = 4;
+    options.fAutoFlush = -30 * 1024 * 1024;
+    options.fSplitLevel = 0;
+    options.fOverwriteIfExists = true;
+    if (format == proc::FriendFormat::kRNTuple) {
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6, 34, 0)
+        options.fOutputFormat = ROOT::RDF::ESnapshotOutputFormat::kRNTuple;
+#else
+        proc::log::info("hub-friend-bench", "[warning]", "Skipping", result.format,
+                        ": RNTuple output requires ROOT 6.34");
+        return std::nullopt;
+#endif
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(output_dir, ec);
+    const auto written =
+        output_dir / ("entry" + std::to_string(entry.entry_id) + "_" + result.format + ".root");
+
+    ROOT::RDataFrame input(entry.friend_tree, source.string());
+    const auto columns = input.GetColumnNames();
+
+    TStopwatch watch;
+    watch.Start();
+    input.Snapshot(entry.friend_tree, written.string(), columns, options);
+    watch.Stop();
+    result.write_seconds = watch.RealTime();
+    result.bytes = std::filesystem::file_size(written, ec);
+
+    std::tie(result.events, result.read_seconds) =
+        timeReads(ROOT::RDataFrame(entry.friend_tree, written.string()), columns);
+
+    // The joined read is what an analysis pays: the dataset chain with the friend attached,
+    // reading the friend columns through the alias.
+    if (format == proc::FriendFormat::kTTree && result.events == entry.n_events && !dataset.empty()) {
+        TChain chain(entry.dataset_tree.c_str());
+        chain.Add(dataset.string().c_str());
+        TChain friend_chain(entry.friend_tree.c_str());
+        friend_chain.Add(written.string().c_str());
+        chain.AddFriend(&friend_chain, "bench");
+
+        std::vector<std::string> aliased;
+        aliased.reserve(columns.size());
+        for (const auto &column : columns) {
+            aliased.push_back("bench." + column);
+        }
+        result.joined_seconds = timeReads(ROOT::RDataFrame(chain), aliased).second;
+    }
+    return result;
+}
+
+StagingMeasurement measureStaging(const proc::HubDataFrame::CatalogEntry &entry, const std::filesystem::path &source,
+                                  std::size_t threads, const std::filesystem::path &output_dir) {
+    proc::FriendWriter::FriendConfig config;
+    config.output_dir = output_dir;
+    config.tree_name = entry.friend_tree;
+    config.compression_threads = threads;
+    proc::FriendWriter writer(config);
+
+    StagingMeasurement result;
+    result.mode = threads == 0 ? "inline" : "staged";
+
+    ROOT::RDataFrame input(entry.friend_tree, source.string());
+    const auto columns = input.GetColumnNames();
+
+    std::error_code ec;
+    std::filesystem::create_directories(output_dir, ec);
+    DiskSampler disk(output_dir);
+    TStopwatch watch;
+    watch.Start();
+    const auto written = writer.writeFriend(input, entry.sample_key, entry.variation + "_" + result.mode, columns);
+    watch.Stop();
+    result.loop_seconds = watch.RealTime();
+    watch.Start(false);
+    writer.flush();
+    watch.Stop();
+    result.total_seconds = watch.RealTime();
+    disk.stop();
+
+    result.bytes = std::filesystem::file_size(written, ec);
+    result.peak_bytes = disk.peakBytes();
+    if (threads > 0) {
+        // The largest file seen is the staged one, which the rewrite reads in full before
+        // writing the final file next to it.
+        result.read_bytes = disk.largestFileBytes();
+        result.rewrite_bytes = result.bytes;
+    }
+    return result;
+}
+
+void reportStaging(const StagingMeasurement &m) {
+    std::cout << std::left << std::setw(9) << m.mode << std::right << std::fixed << std::setprecision(2)
+              << std::setw(14) << m.loop_seconds << std::setw(16) << m.total_seconds << std::setw(16) << m.peak_bytes
+              << std::setw(16) << m.bytes << std::setw(16) << m.read_bytes << std::setw(16) << m.rewrite_bytes
+              << std::endl;
+}
+
+void report(const Measurement &m) {
+    const double events = static_cast<double>(m.events);
+    std::cout << std::left << std::setw(9) << m.format << std::right << std::setw(14) << m.bytes << std::setw(16)
+              << std::fixed << std::setprecision(0) << (m.write_seconds > 0.0 ? events / m.write_seconds : 0.0)
+              << std::setw(16) << (m.read_seconds > 0.0 ? events / m.read_seconds : 0.0) << std::setw(16);
+    if (m.joined_seconds) {
+        std::cout << (*m.joined_seconds > 0.0 ? events / *m.joined_seconds : 0.0) << std::endl;
+    } else {
+        std::cout << "n/a" << std::endl;
+    }
+}
+
+void runBenchmark(const Options &opts) {
+    if (opts.hub_path.empty()) {
+        throw std::runtime_error("--hub is required");
+    }
+
+    proc::HubDataFrame hub(opts.hub_path);
+    const auto hub_dir = std::filesystem::absolute(std::filesystem::path(opts.hub_path)).parent_path();
+
+    std::size_t benchmarked = 0;
+    for (const auto &entry : hub.catalog()) {
+        if (benchmarked >= opts.max_entries) {
+            break;
+        }
+        if (entry.friend_path.empty() || entry.n_events == 0ULL) {
+            continue;
+        }
+        std::filesystem::path source(entry.friend_path);
+        if (source.is_relative()) {
+            source = hub_dir / source;
+        }
+        std::filesystem::path dataset(entry.dataset_path);
+        if (!dataset.empty() && dataset.is_relative()) {
+            dataset = hub.resolvedBaseDirectory() / dataset;
+        }
+
+        std::cout << "\n" << entry.sample_key << " " << entry.variation << " (" << entry.n_events << " events)"
+                  << std::endl;
+        std::cout << std::left << std::setw(9) << "format" << std::right << std::setw(14) << "bytes" << std::setw(16)
+                  << "write evt/s" << std::setw(16) << "read evt/s" << std::setw(16) << "joined evt/s" << std::endl;
+        for (const auto format : {proc::FriendFormat::kTTree, proc::FriendFormat::kRNTuple}) {
+            if (auto measurement = measure(entry, source, dataset, format, opts.output_dir)) {
+                report(*measurement);
+            }
+        }
+
+        std::cout << std::left << std::setw(9) << "compress" << std::right << std::setw(14) << "loop s"
+                  << std::setw(16) << "final s" << std::setw(16) << "peak disk" << std::setw(16) << "bytes"
+                  << std::setw(16) << "extra read" << std::setw(16) << "extra write" << std::endl;
+        reportStaging(measureStaging(entry, source, 0, opts.output_dir));
+        if (opts.staging_threads > 0) {
+            reportStaging(measureStaging(entry, source, opts.staging_threads, opts.output_dir));
+        }
+        ++benchmarked;
+    }
+
+    if (benchmarked == 0) {
+        throw std::runtime_error("No catalogue entries with a friend file to benchmark");
+    }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    try {
+        auto options = parseOptions(argc, argv);
+        if (options.show_help) {
+            printUsage();
+            return 0;
+        }
+        runBenchmark(options);
+        return 0;
+    } catch (const std::exception &ex) {
+        std::cerr << "hub-friend-bench: " << ex.what() << std::endl;
+        return 1;
+    }
+}
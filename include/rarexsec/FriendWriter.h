@@ -2,51 +2,194 @@
 #define FRIEND_WRITER_H
 
 #include <filesystem>
+#include <map>
+#include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <Compression.h>
 
+#include <rarexsec/HubCatalog.h>
+
 #include "ROOT/RDataFrame.hxx"
 
+class TFile;
+class TTree;
+
 namespace proc {
 
 class FriendWriter {
   public:
+    struct CompressionPolicy {
+        ROOT::ECompressionAlgorithm algorithm = ROOT::kZSTD;
+        int level = 4;
+    };
+
+    // How auto compression trades size against read and write speed when choosing a codec.
+    enum class CompressionObjective { kReadSpeed, kBalanced, kSize };
+
     struct FriendConfig {
         FriendConfig()
             : output_dir(std::filesystem::path{"friends"}),
               compression_algo(ROOT::kZSTD),
               compression_level(4),
-              tree_name("meta") {}
+              tree_name("meta"),
+              zone_map_flags{"base_sel", "pass_final"},
+              zone_map_ranges{"w_nom"},
+              output_format(FriendFormat::kTTree) {}
 
         std::filesystem::path output_dir;
         ROOT::ECompressionAlgorithm compression_algo;
         int compression_level;
         std::string tree_name;
+        // Columns summarised per TTree cluster in the <tree_name>_clusters side table:
+        // passing counts for boolean flags and min/max for double-valued columns.
+        std::vector<std::string> zone_map_flags;
+        std::vector<std::string> zone_map_ranges;
+        // Per-column codecs, applied by a rewrite pass after the snapshot. Column policies win
+        // over type policies; type keys are RDataFrame column types ("bool", "double", ...)
+        // or "scalar" / "collection". Unmatched columns keep compression_algo/level.
+        std::map<std::string, CompressionPolicy> column_compression;
+        std::map<std::string, CompressionPolicy> type_compression;
+        // Chooses a codec for each unmatched column by trial-compressing a few of its clusters,
+        // timing both the fill and repeated reads.
+        bool auto_compression = false;
+        CompressionObjective compression_objective = CompressionObjective::kBalanced;
+        // RNTuple output needs ROOT 6.34 or newer. The side tables and per-column compression
+        // are TTree-only and are skipped for RNTuple friends.
+        FriendFormat output_format;
+        // Stores the friend in a narrower layout: int *_category codes as unsigned 8-bit
+        // integers offset by one, scalar bool flags as bits of 32-bit words, bool arrays
+        // (muon_mask) as bit arrays, and event_uid not at all with derive_event_uid. The layout
+        // is recorded in <tree_name>_layout and undone by HubDataFrame on read.
+        bool pack_columns = false;
+        // With pack_columns, drops event_uid from every file (HubDataFrame rebuilds it from
+        // run/sub/evt with makeEventUid). Set once per hub so all its files share one layout;
+        // a zero uid, written for datasets without run/sub/evt, is then an error.
+        bool derive_event_uid = false;
+        // Collection columns with equal per-event lengths, keyed by the count branch they share.
+        // Each is stored as a <column>[<count>] array instead of carrying its own size branch;
+        // RDataFrame still reads them as RVecs viewing the basket buffers. The lengths must
+        // agree in every event.
+        std::map<std::string, std::vector<std::string>> shared_counts;
+        // Opt-in write-behind staging. With threads, snapshots are written uncompressed, and the
+        // compressing rewrite and side tables run in the background, so the event loop does not
+        // wait on the codec. The loop still makes the write() calls, for the uncompressed bytes.
+        // Each friend then costs an extra full read and rewrite, about twice the friend I/O, and
+        // holds up to its uncompressed size on disk until the rewrite lands. At most
+        // compression_queue_depth files wait for a worker; further writes block until one frees.
+        // Call flush() before reading the friends. The default (0) compresses inline. Compare
+        // the two with hub-friend-bench.
+        std::size_t compression_threads = 0;
+        std::size_t compression_queue_depth = 4;
     };
 
+    // One column of a packed friend. Encodings: "uint8" (source holds value + `bit` as
+    // UChar_t), "bit" (bit `bit` of the UInt_t word in source), "bitarray" (source holds a
+    // bool array as UChar_t bits followed by a stop bit) and "derived" (not stored). Friends
+    // written before "uint8" existed use "int8" (source holds the value as Char_t).
+    struct PackedColumn {
+        std::string column;
+        std::string encoding;
+        std::string source;
+        int bit = 0;
+    };
+
+    // Cluster edges of an input tree: cluster i covers entries [edges[i], edges[i + 1]).
+    // Passed to writeFriend, they make the friend's clusters cover the same entry ranges, so
+    // multithreaded reads of the dataset and its friend split on shared boundaries.
+    using ClusterBoundaries = std::vector<Long64_t>;
+
+    // One friend of a writeFriends call. node must share its event loop with the other
+    // targets' nodes; writer's config (tree name, format, codecs) applies to the file.
+    struct FriendTarget {
+        ROOT::RDF::RNode node;
+        const FriendWriter *writer;
+        std::filesystem::path path;
+        std::vector<std::string> columns;
+    };
+
+    // Edges of the (file, tree) inputs chained in order; empty if any input cannot be read.
+    static ClusterBoundaries inputClusters(const std::vector<std::pair<std::string, std::string>> &inputs);
+
+    static std::string clusterTableName(const std::string &tree_name) { return tree_name + "_clusters"; }
+    // (event_uid, entry) pairs sorted by event_uid, used for point lookups.
+    static std::string uidIndexName(const std::string &tree_name) { return tree_name + "_uid_index"; }
+    static std::string layoutTableName(const std::string &tree_name) { return tree_name + "_layout"; }
+
     explicit FriendWriter(const FriendConfig &config = FriendConfig{});
 
+    const FriendConfig &config() const noexcept { return config_; }
+
     std::filesystem::path writeFriend(ROOT::RDF::RNode df,
                                       const std::string &sample_key,
                                       const std::string &variation,
-                                      const std::vector<std::string> &columns) const;
+                                      const std::vector<std::string> &columns,
+                                      const ClusterBoundaries &clusters = {}) const;
 
     std::filesystem::path writeFriendToPath(ROOT::RDF::RNode df,
                                             const std::filesystem::path &path,
-                                            const std::vector<std::string> &columns) const;
+                                            const std::vector<std::string> &columns,
+                                            const ClusterBoundaries &clusters = {}) const;
+
+    // Writes several friends from a single event loop: the snapshots are booked lazily and
+    // run together, then each file gets its writer's rewrite and side tables.
+    static void writeFriends(const std::vector<FriendTarget> &targets, const ClusterBoundaries &clusters = {});
+
+    // Path writeFriend uses for a sample and variation.
+    std::filesystem::path generateFriendPath(const std::string &sample_key, const std::string &variation) const;
+
+    // Rebuilds the cluster zone map and uid index of an existing friend file, for example
+    // after several friends were merged into one.
+    void writeSideTables(const std::filesystem::path &path, const std::vector<std::string> &columns) const;
+
+    // Waits for background compression to finish and rethrows the first failure.
+    void flush() const;
 
   private:
+    class CompressionQueue;
+
+    struct SharedCountGroup {
+        std::string count;
+        std::vector<std::string> columns;
+        std::vector<std::string> count_branches;
+        Int_t max_length = 0;
+    };
+
     FriendConfig config_;
+    std::shared_ptr<CompressionQueue> queue_;
+    // Synchronous copy of this writer used by queued jobs, which must not refer back to *this.
+    std::shared_ptr<const FriendWriter> finisher_;
 
     ROOT::RDF::RSnapshotOptions makeSnapshotOptions() const;
     std::filesystem::path writeFriendToPath(ROOT::RDF::RNode df,
                                             const std::filesystem::path &path,
                                             const std::vector<std::string> &columns,
+                                            const ClusterBoundaries &clusters,
                                             const ROOT::RDF::RSnapshotOptions &options) const;
-    std::filesystem::path generateFriendPath(const std::string &sample_key,
-                                             const std::string &variation) const;
+    // Rewrite and side tables of a friend whose snapshot has been written.
+    std::filesystem::path finishFriend(ROOT::RDF::RNode df, const std::filesystem::path &path,
+                                       const std::vector<std::string> &columns, const ClusterBoundaries &clusters) const;
+    void writeClusterZoneMap(TFile &file, TTree &tree, const std::vector<std::string> &columns) const;
+    void writeUidIndex(TFile &file, TTree &tree) const;
+    void writeUidTable(TFile &file, std::vector<std::pair<ULong64_t, Long64_t>> index) const;
+    std::vector<PackedColumn> planPacking(TTree &tree, const std::vector<std::string> &columns) const;
+    std::vector<SharedCountGroup> planSharedCounts(TTree &tree) const;
+    void writeLayout(TFile &file, const std::vector<PackedColumn> &layout) const;
+    std::vector<PackedColumn> readLayout(TFile &file) const;
+    bool hasCompressionPolicies() const;
+    std::map<std::string, CompressionPolicy> resolveCompressionPolicies(ROOT::RDF::RNode &df,
+                                                                        const std::vector<std::string> &columns) const;
+    // Rewrites the friend with per-column codecs, realigned clusters, packed columns and/or
+    // shared count branches.
+    // recompress_all re-encodes every branch, for staged files written without compression.
+    void rewrite(const std::filesystem::path &path, const std::vector<std::string> &columns,
+                 std::map<std::string, CompressionPolicy> policies, ClusterBoundaries clusters,
+                 bool recompress_all = false) const;
+    void finishStaged(const std::filesystem::path &path, const std::vector<std::string> &columns,
+                      std::map<std::string, CompressionPolicy> policies, ClusterBoundaries clusters) const;
+    CompressionPolicy chooseCompression(TTree &tree, const std::string &column) const;
 };
 
 } // namespace proc
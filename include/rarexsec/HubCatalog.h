@@ -1,8 +1,12 @@
 #ifndef HUB_CATALOG_H
 #define HUB_CATALOG_H
 
+#include <cctype>
+#include <cstring>
+#include <fstream>
 #include <memory>
 #include <mutex>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
@@ -13,6 +17,73 @@ namespace proc {
 
 struct ProvenanceDicts;
 
+// Identifier of an event within the hub, built from the dataset's run, subrun and event.
+inline ULong64_t makeEventUid(int run, int sub, int evt) {
+    return (static_cast<ULong64_t>(run) << 42U) | (static_cast<ULong64_t>(sub) << 21U) | static_cast<ULong64_t>(evt);
+}
+
+// Fast, non-cryptographic 64-bit hash of a file's bytes, recorded in the catalog so that a
+// truncated or rewritten friend can be detected. Reads the file once in 1 MiB blocks.
+inline ULong64_t fileChecksum(const std::string &path) {
+    std::ifstream input(path, std::ios::binary);
+    if (!input) {
+        throw std::runtime_error("Unable to read " + path + " to checksum it");
+    }
+    auto mix = [](ULong64_t hash, ULong64_t word) {
+        hash = (hash ^ word) * 0x9E3779B97F4A7C15ULL;
+        return hash ^ (hash >> 29U);
+    };
+    std::vector<char> buffer(1U << 20U);
+    ULong64_t hash = 0xCBF29CE484222325ULL;
+    ULong64_t length = 0ULL;
+    while (input) {
+        input.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        const auto n = static_cast<std::size_t>(input.gcount());
+        std::size_t i = 0;
+        for (; i + sizeof(ULong64_t) <= n; i += sizeof(ULong64_t)) {
+            ULong64_t word = 0ULL;
+            std::memcpy(&word, buffer.data() + i, sizeof(word));
+            hash = mix(hash, word);
+        }
+        if (i < n) {
+            ULong64_t word = 0ULL;
+            std::memcpy(&word, buffer.data() + i, n - i);
+            hash = mix(hash, word);
+        }
+        length += n;
+    }
+    return mix(hash, length);
+}
+
+// Storage format of a friend file. Stored as a string in the catalog; an empty value
+// (hubs written before the field existed) means TTree.
+enum class FriendFormat { kTTree, kRNTuple };
+
+inline const char *friendFormatName(FriendFormat format) {
+    return format == FriendFormat::kRNTuple ? "rntuple" : "ttree";
+}
+
+// Makes a catalogue field safe for file names and tree aliases: characters other than
+// alphanumerics, '_' and '-' become '_', and an empty value becomes "none".
+inline std::string sanitiseComponent(const std::string &value) {
+    std::string result;
+    result.reserve(value.size());
+    for (char ch : value) {
+        const unsigned char uc = static_cast<unsigned char>(ch);
+        result.push_back((std::isalnum(uc) || ch == '_' || ch == '-') ? ch : '_');
+    }
+    return result.empty() ? std::string{"none"} : result;
+}
+
+// One row of an entry's zone map: per-column statistics gathered while the friend
+// tree is written, used to skip entries and answer count/yield queries.
+struct HubEntryStat {
+    std::string column;
+    std::string kind;
+    Long64_t key = 0;
+    Double_t value = 0.0;
+};
+
 struct HubEntry {
     // Identity
     UInt_t entry_id = 0U;
@@ -27,6 +98,10 @@ struct HubEntry {
     std::string dataset_tree;
     std::string friend_path;
     std::string friend_tree;
+    std::string friend_format;
+    // Integrity record of the primary friend, stored on its entry_friends row.
+    ULong64_t friend_bytes = 0ULL;
+    ULong64_t friend_checksum = 0ULL;
 
     // Summary
     ULong64_t n_events = 0ULL;
@@ -43,6 +118,9 @@ struct HubEntry {
     std::string variation;
     std::string origin;
     std::string stage;
+
+    // Zone map
+    std::vector<HubEntryStat> stats;
 };
 
 struct HubFriend {
@@ -50,6 +128,26 @@ struct HubFriend {
     std::string label;
     std::string tree;
     std::string path;
+    std::string format;
+    // First row of this entry inside a friend file shared by several entries (see hub-compact).
+    Long64_t entry_offset = 0;
+    // Integrity record: rows belonging to the entry, file size and fileChecksum. A negative
+    // count or zero size means the hub predates the record.
+    Long64_t n_entries = -1;
+    ULong64_t file_bytes = 0ULL;
+    ULong64_t checksum = 0ULL;
+};
+
+// Points an entry's friend (matched on entry_id and label) at a merged or rewritten file.
+struct HubFriendRelocation {
+    UInt_t entry_id = 0U;
+    std::string label;
+    std::string path;
+    Long64_t entry_offset = 0;
+    // Integrity record of the new file; a negative n_entries keeps the recorded count.
+    Long64_t n_entries = -1;
+    ULong64_t file_bytes = 0ULL;
+    ULong64_t checksum = 0ULL;
 };
 
 class HubCatalog {
@@ -64,6 +162,8 @@ class HubCatalog {
 
     void addFriend(const HubFriend &friend_entry);
     void addFriends(const std::vector<HubFriend> &friend_entries);
+    // Update mode only: rewrites the catalog and friend trees with the new locations.
+    void relocateFriends(const std::vector<HubFriendRelocation> &relocations);
 
     void writeDictionaries(const ProvenanceDicts &dicts);
     void writeSummary(double total_pot, long total_triggers, const std::string &base_directory,
@@ -75,10 +175,13 @@ class HubCatalog {
     TTree *catalog_tree_;
     TTree *meta_tree_;
     TTree *friend_tree_;
+    TTree *stats_tree_;
     mutable std::mutex mutex_;
 
     HubEntry current_entry_;
     HubFriend current_friend_;
+    UInt_t current_stat_entry_id_;
+    HubEntryStat current_stat_;
     UInt_t next_entry_id_;
     std::string meta_key_;
     std::string meta_value_;
@@ -3,14 +3,22 @@
 
 #include <cstdint>
 #include <filesystem>
+#include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
+#include <set>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+#include <rarexsec/LocalFileCache.h>
+
 #include "ROOT/RDataFrame.hxx"
+#include "ROOT/RResultHandle.hxx"
 #include "TChain.h"
+#include "TEntryList.h"
 
 namespace proc {
 
@@ -29,9 +37,26 @@ class HubDataFrame {
             std::string label;
             std::string tree;
             std::string path;
+            std::string format;
+            // First row of this entry in a friend file shared with other entries (hub-compact).
+            std::uint64_t entry_offset = 0ULL;
+            // Integrity record written with the friend (see HubFriend); unset in older hubs.
+            std::int64_t n_entries = -1;
+            std::uint64_t file_bytes = 0ULL;
+            std::uint64_t checksum = 0ULL;
+        };
+
+        // Per-entry statistics recorded at build time (see HubEntryStat).
+        struct ZoneMap {
+            bool available = false;
+            std::map<std::string, std::uint64_t> pass_counts;
+            std::map<std::string, double> pass_yields;
+            std::map<std::string, std::pair<double, double>> ranges;
+            std::map<std::string, std::map<std::int64_t, std::uint64_t>> category_counts;
         };
 
         std::uint32_t entry_id = 0U;
+        std::uint32_t hub_index = 0U;
         std::uint32_t sample_id = 0U;
         std::uint16_t beam_id = 0U;
         std::uint16_t period_id = 0U;
@@ -41,6 +66,7 @@ class HubDataFrame {
         std::string dataset_tree;
         std::string friend_path;
         std::string friend_tree;
+        std::string friend_format;
         std::uint64_t n_events = 0ULL;
         std::uint64_t first_event_uid = 0ULL;
         std::uint64_t last_event_uid = 0ULL;
@@ -54,6 +80,7 @@ class HubDataFrame {
         std::string origin;
         std::string stage;
         std::vector<FriendInfo> friends;
+        ZoneMap zone_map;
     };
 
     struct Combination {
@@ -92,9 +119,35 @@ class HubDataFrame {
         Selection &clearOrigin();
         Selection &clearStage();
 
+        // Predicates backed by the zone maps: entries that cannot contain passing events
+        // are skipped and load() applies the matching filters.
+        Selection &require(const std::string &flag);
+        Selection &category(const std::string &column, int value);
+        Selection &clearPredicates();
+
+        // Declares the columns the analysis reads. Labelled friends (for example cnn) are
+        // then attached only when a column is referenced as <label>.<column>; the primary
+        // friend is always attached. Without a declaration every friend is attached.
+        Selection &columns(const std::vector<std::string> &names);
+        Selection &clearColumns();
+
         std::vector<const CatalogEntry *> entries() const;
+        // The entries load() chains, in chain order: compacted groups whole, in friend-row order.
+        std::vector<const CatalogEntry *> chainEntries() const;
+        // Resolved (file, tree) pairs of the dataset chain, in the order load() chains them.
+        std::vector<std::pair<std::string, std::string>> datasetTrees() const;
         ROOT::RDF::RNode load();
 
+        // RNTuple friends cannot be attached to the dataset TChain, so load() throws when one
+        // would be; this reads the friend with the given label on its own. Rows follow the
+        // dataset chain of load() one to one.
+        ROOT::RDF::RNode loadFriend(const std::string &label = "");
+
+        // Answered from the catalog without reading events; empty when the zone maps
+        // cannot express the selection exactly.
+        std::optional<std::uint64_t> count() const;
+        std::optional<double> yield() const;
+
       private:
         HubDataFrame &owner_;
         std::optional<std::string> sample_;
@@ -103,12 +156,36 @@ class HubDataFrame {
         std::optional<std::string> variation_;
         std::optional<std::string> origin_;
         std::optional<std::string> stage_;
+        std::vector<std::string> flags_;
+        std::vector<std::pair<std::string, int>> categories_;
+        std::optional<std::vector<std::string>> columns_;
+
+        friend class HubDataFrame;
     };
 
     explicit HubDataFrame(const std::string &hub_path);
 
+    // Federated view: the catalogs of every hub are merged in memory, entry ids are made
+    // unique and provenance ids are re-interned against the first hub's dictionaries.
+    explicit HubDataFrame(const std::vector<std::string> &hub_paths);
+
     Selection select();
 
+    // Loads several selections at once, assembling their chains on up to one thread per core.
+    // Results booked on the returned nodes can then be triggered together with runAll().
+    std::vector<ROOT::RDF::RNode> loadMany(const std::vector<Selection> &selections);
+    static unsigned int runAll(std::vector<ROOT::RDF::RResultHandle> handles);
+
+    struct EventLocation {
+        const CatalogEntry *entry = nullptr;
+        Long64_t tree_entry = -1;
+    };
+
+    // Point lookup by event_uid: candidate entries are narrowed by their uid range and the
+    // friend uid index is binary-searched. The node covers that single event.
+    std::optional<EventLocation> locateEvent(std::uint64_t event_uid) const;
+    std::optional<ROOT::RDF::RNode> findEvent(std::uint64_t event_uid);
+
     ROOT::RDF::RNode query(const std::string &beam, const std::string &period,
                            const std::string &variation = "nominal", const std::string &origin = "",
                            const std::string &stage = "");
@@ -142,6 +219,7 @@ class HubDataFrame {
                                         const std::optional<std::string> &period = std::nullopt,
                                         const std::optional<std::string> &origin = std::nullopt,
                                         const std::optional<std::string> &stage = std::nullopt) const;
+    std::vector<std::string> hubPaths() const;
     std::vector<std::string> sampleKeys(const std::optional<std::string> &beam = std::nullopt,
                                         const std::optional<std::string> &period = std::nullopt,
                                         const std::optional<std::string> &stage = std::nullopt,
@@ -151,6 +229,36 @@ class HubDataFrame {
     void clearBaseDirectoryOverride();
     std::filesystem::path resolvedBaseDirectory() const;
 
+    // Mirrors dataset and friend files into a local directory (see LocalFileCache) so that
+    // later passes read them from local disk.
+    void setLocalCache(const std::filesystem::path &directory, std::uintmax_t budget_bytes);
+    void clearLocalCache();
+    const LocalFileCache *localCache() const noexcept { return local_cache_.get(); }
+
+    // Chains are cached per set of catalog entries. Nodes returned by load() keep their
+    // chains alive, so evicting a bundle never invalidates a node that is still in use.
+    // Each load() gets its own RDataFrame and event loop; loads of one selection share the
+    // TChain, so without implicit MT their loops run one after another (as RunGraphs does).
+    void setChainCacheCapacity(std::size_t capacity);
+    std::size_t chainCacheCapacity() const;
+    std::size_t cachedChainCount() const;
+    void clearChainCache();
+
+    // Opens the next files of the dataset and friend chains in the background and pre-reads
+    // their clusters while the event loop works on the current one; each new event loop over
+    // a cached chain restarts the window. Zero disables it.
+    void setPrefetchDepth(std::size_t files);
+    std::size_t prefetchDepth() const noexcept { return prefetch_depth_; }
+
+    // Checks made against the catalog's integrity records before chains are built. kCounts
+    // compares file sizes and tree entry counts from file metadata only; kChecksums also
+    // rehashes every friend file, in parallel. Failures throw before the event loop starts.
+    enum class IntegrityCheck { kNone, kCounts, kChecksums };
+    void setIntegrityCheck(IntegrityCheck level) noexcept { integrity_check_ = level; }
+    IntegrityCheck integrityCheck() const noexcept { return integrity_check_; }
+    // Checks every catalog entry and returns one message per problem found.
+    std::vector<std::string> verify(IntegrityCheck level = IntegrityCheck::kChecksums) const;
+
   private:
     std::vector<const CatalogEntry *> resolveEntries(const std::optional<std::string> &sample,
                                                      const std::optional<std::string> &beam,
@@ -160,30 +268,109 @@ class HubDataFrame {
                                                      const std::optional<std::string> &stage) const;
     ROOT::RDF::RNode loadSelection(const std::optional<std::string> &sample, const std::optional<std::string> &beam,
                                    const std::optional<std::string> &period, const std::optional<std::string> &variation,
-                                   const std::optional<std::string> &origin, const std::optional<std::string> &stage);
-    ROOT::RDF::RNode buildDataFrame(const std::vector<const CatalogEntry *> &entries);
+                                   const std::optional<std::string> &origin, const std::optional<std::string> &stage,
+                                   const std::vector<std::string> &flags = {},
+                                   const std::vector<std::pair<std::string, int>> &categories = {},
+                                   const std::optional<std::vector<std::string>> &columns = std::nullopt);
+    // Entries whose friends were merged by hub-compact share one friend file; they are kept
+    // or dropped together and chained contiguously in offset order so friend rows line up.
+    std::vector<const CatalogEntry *> compactedGroup(const CatalogEntry &entry) const;
+    std::vector<const CatalogEntry *> alignCompactedGroups(const std::vector<const CatalogEntry *> &entries) const;
+    static std::uint64_t friendOffset(const CatalogEntry &entry);
+    ROOT::RDF::RNode loadFriendFrame(const std::vector<const CatalogEntry *> &entries, const std::string &label) const;
+    static std::vector<const CatalogEntry *> pruneEntries(const std::vector<const CatalogEntry *> &entries,
+                                                          const std::vector<std::string> &flags,
+                                                          const std::vector<std::pair<std::string, int>> &categories);
 
-    std::filesystem::path resolveDatasetPath(const CatalogEntry &entry) const;
-    std::filesystem::path resolveFriendPath(const CatalogEntry &entry) const;
-    std::filesystem::path resolveFriendPath(const std::string &friend_path) const;
+    struct BundleOptions {
+        std::vector<std::string> flags;
+        std::optional<std::set<std::string>> friend_labels;
+    };
 
-    void loadMetadata();
-    void loadCatalog();
-    void loadFriendMetadata();
+    ROOT::RDF::RNode buildDataFrame(const std::vector<const CatalogEntry *> &entries,
+                                    const BundleOptions &options = {});
+
+    class Prefetcher;
 
-    std::string hub_path_;
-    std::string hub_directory_;
-    std::unique_ptr<TChain> current_chain_;
     struct FriendChain {
         std::unique_ptr<TChain> chain;
         std::string alias;
         std::string key;
     };
-    std::vector<FriendChain> friend_chains_; //! transient helper chains, not part of the ROOT dictionary
+    // A primary-friend column stored in FriendWriter's packed layout (<tree>_layout).
+    struct PackedColumn {
+        std::string column;
+        std::string encoding;
+        std::string source;
+        int bit = 0;
+    };
+    // Member order matters: the prefetcher stops first, the chain is torn down before the
+    // friends it references, and the pins on mirrored copies are released last. Dataframes
+    // are made per node by makeNode().
+    struct ChainBundle {
+        LocalFileCache::PinSet pins;
+        std::vector<PackedColumn> packed_columns;
+        std::vector<FriendChain> friends;
+        std::unique_ptr<TEntryList> entry_list;
+        std::unique_ptr<TChain> chain;
+        std::shared_ptr<Prefetcher> prefetcher;
+    };
+    struct ChainCache {
+        using Slot = std::pair<std::string, std::shared_ptr<ChainBundle>>;
+        std::mutex mutex;
+        std::list<Slot> lru;
+        std::unordered_map<std::string, std::list<Slot>::iterator> index;
+        std::size_t capacity = 8;
+    };
+
+    std::shared_ptr<ChainBundle> acquireBundle(const std::vector<const CatalogEntry *> &entries,
+                                               const BundleOptions &options);
+    std::shared_ptr<ChainBundle> buildBundle(const std::vector<const CatalogEntry *> &requested,
+                                             const BundleOptions &options) const;
+    std::unique_ptr<TEntryList> buildClusterEntryList(const std::vector<const CatalogEntry *> &entries,
+                                                      const std::vector<std::string> &flags,
+                                                      const std::string &dataset_tree) const;
+    static ROOT::RDF::RNode makeNode(const std::shared_ptr<ChainBundle> &bundle);
+    static std::vector<PackedColumn> readPackedLayout(const std::string &path, const std::string &tree_name);
+    static ROOT::RDF::RNode unpackColumns(ROOT::RDF::RNode node, const std::vector<PackedColumn> &layout);
+    std::vector<std::string> checkIntegrity(const std::vector<const CatalogEntry *> &entries,
+                                            IntegrityCheck level) const;
+    std::optional<Long64_t> searchUidIndex(const CatalogEntry &entry, std::uint64_t event_uid) const;
+    std::optional<std::vector<std::pair<Long64_t, Long64_t>>> readPassingClusters(
+        const CatalogEntry &entry, const std::vector<std::string> &flags) const;
+
+    // With pins, mirrored copies stay on disk until the pins are released.
+    std::filesystem::path resolveDatasetPath(const CatalogEntry &entry, LocalFileCache::PinSet *pins = nullptr) const;
+    std::filesystem::path resolveFriendPath(const CatalogEntry &entry, LocalFileCache::PinSet *pins = nullptr) const;
+    std::filesystem::path resolveFriendPath(const CatalogEntry &entry, const std::string &friend_path,
+                                            LocalFileCache::PinSet *pins = nullptr) const;
+    std::filesystem::path locateDatasetPath(const CatalogEntry &entry) const;
+    std::filesystem::path mirrored(const std::filesystem::path &path, LocalFileCache::PinSet *pins = nullptr) const;
+
+    void loadMetadata();
+    void loadCatalog();
+    void loadFriendMetadata();
+    void loadZoneMaps();
+    void mergeHub(HubDataFrame &&other);
+
+    struct HubSource {
+        std::string path;
+        std::string directory;
+        std::string resolved_base_directory;
+    };
+    const HubSource &hubFor(const CatalogEntry &entry) const;
+
+    std::string hub_path_;
+    std::string hub_directory_;
+    std::vector<HubSource> hubs_; //! transient, rebuilt when the hubs are opened
+    std::unique_ptr<ChainCache> chain_cache_; //! transient helper chains, not part of the ROOT dictionary
     Summary summary_;
     std::vector<CatalogEntry> entries_;
     ProvenanceDictionaries provenance_dicts_;
     std::optional<std::string> base_directory_override_;
+    std::size_t prefetch_depth_ = 0;
+    IntegrityCheck integrity_check_ = IntegrityCheck::kCounts;
+    std::unique_ptr<LocalFileCache> local_cache_; //! transient, not part of the ROOT dictionary
 };
 
 } // namespace proc
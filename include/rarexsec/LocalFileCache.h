@@ -0,0 +1,53 @@
+#ifndef LOCAL_FILE_CACHE_H
+#define LOCAL_FILE_CACHE_H
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+namespace proc {
+
+// Mirrors input files into a local directory so that repeated passes read from local disk.
+// Entries are keyed by source path, size and modification time; the directory is kept under
+// a byte budget by evicting the least recently used copies. A lock file serialises updates
+// between processes sharing the same cache. Copies in use are pinned with a shared flock and
+// are never evicted, and copies in flight reserve their bytes until they land.
+class LocalFileCache {
+  public:
+    // Shared lock on one cached copy, held for as long as the copy may still be opened.
+    class Pin;
+    using PinSet = std::vector<std::shared_ptr<const Pin>>;
+
+    LocalFileCache(const std::filesystem::path &directory, std::uintmax_t budget_bytes);
+
+    // Returns the local copy of source, mirroring it first if needed, and adds its pin to
+    // pins. Falls back to source when the file cannot be cached (missing, remote, larger than
+    // the budget, budget held by pinned copies, copy failure). Without pins the copy can be
+    // evicted as soon as this returns.
+    std::filesystem::path resolve(const std::filesystem::path &source, PinSet *pins = nullptr) const;
+
+    const std::filesystem::path &directory() const noexcept { return directory_; }
+    std::uintmax_t budget() const noexcept { return budget_bytes_; }
+    std::uintmax_t usage() const;
+
+  private:
+    class DirectoryLock;
+    class Reservation;
+
+    std::filesystem::path cachedPath(const std::filesystem::path &source, std::uintmax_t size,
+                                     std::int64_t mtime) const;
+    // Frees room for incoming bytes among unpinned copies; false when the budget cannot be met.
+    bool evictFor(std::uintmax_t incoming) const;
+
+    std::filesystem::path directory_;
+    std::uintmax_t budget_bytes_;
+};
+
+} // namespace proc
+
+#if defined(RAREXSEC_HEADER_ONLY) && RAREXSEC_HEADER_ONLY
+#include <rarexsec/detail/LocalFileCacheImpl.h>
+#endif
+
+#endif
@@ -51,6 +51,25 @@ class SnapshotPipelineBuilder {
 
     void printAllBranches() const;
 
+    // Storage format of the friend trees written by snapshot() into a hub. Only kTTree is
+    // accepted: the primary friend carries the chain's weights and provenance, and
+    // HubDataFrame::load() cannot join an RNTuple friend. RNTuple stays available for labelled
+    // friends (hub-attach-friends --format rntuple).
+    void setFriendFormat(FriendFormat format);
+    FriendFormat getFriendFormat() const noexcept { return friend_format_; }
+    // Closes friend clusters at the dataset tree's cluster edges (see FriendWriter::inputClusters).
+    void setAlignFriendClusters(bool align) noexcept { align_friend_clusters_ = align; }
+    bool getAlignFriendClusters() const noexcept { return align_friend_clusters_; }
+    // Writes friends in the packed layout (see FriendWriter::FriendConfig::pack_columns), with
+    // the muon track columns sharing one count branch.
+    void setPackFriendColumns(bool pack) noexcept { pack_friend_columns_ = pack; }
+    bool getPackFriendColumns() const noexcept { return pack_friend_columns_; }
+    // Background threads that compress friends while the next event loops run (0, the default,
+    // compresses inline). Staging trades disk and an extra rewrite for event-loop time; see
+    // FriendWriter::FriendConfig::compression_threads.
+    void setFriendCompressionThreads(std::size_t threads) noexcept { friend_compression_threads_ = threads; }
+    std::size_t getFriendCompressionThreads() const noexcept { return friend_compression_threads_; }
+
   private:
     const RunConfigRegistry &run_registry_;
     VariableRegistry var_registry_;
@@ -59,6 +78,10 @@ class SnapshotPipelineBuilder {
     std::string beam_;
     std::vector<std::string> periods_;
     bool blind_;
+    FriendFormat friend_format_ = FriendFormat::kTTree;
+    bool align_friend_clusters_ = false;
+    bool pack_friend_columns_ = false;
+    std::size_t friend_compression_threads_ = 0;
 
     double total_pot_;
     long total_triggers_;
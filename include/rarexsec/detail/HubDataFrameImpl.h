@@ -1,14 +1,27 @@
 #ifndef RAREXSEC_DETAIL_HUBDATAFRAMEIMPL_H
 #define RAREXSEC_DETAIL_HUBDATAFRAMEIMPL_H
 
+#include <rarexsec/HubCatalog.h>
 #include <rarexsec/HubDataFrame.h>
 #include <rarexsec/LoggerUtils.h>
 
+#include <ROOT/RDFHelpers.hxx>
 #include <ROOT/RDataFrame.hxx>
 #include <TChain.h>
+#include <TEntryList.h>
+#include <TFile.h>
+#include <TROOT.h>
+#include <TTree.h>
+#include <TTreeReader.h>
+#include <TTreeReaderValue.h>
 
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
 #include <filesystem>
+#include <functional>
+#include <map>
 #include <nlohmann/json.hpp>
 #include <optional>
 #include <set>
@@ -22,12 +35,23 @@
 #include <utility>
 #include <vector>
 #include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 namespace {
 
 constexpr const char *kCatalogTreeName = "entries";
 constexpr const char *kMetaTreeName = "hub_meta";
 constexpr const char *kFriendLinkTreeName = "entry_friends";
+constexpr const char *kStatsTreeName = "entry_stats";
+constexpr const char *kClusterTableSuffix = "_clusters";
+constexpr const char *kUidIndexSuffix = "_uid_index";
+constexpr const char *kLayoutSuffix = "_layout";
+constexpr const char *kRNTupleFormat = "rntuple";
+constexpr const char *kPrefetchColumn = "hub_prefetch_";
+constexpr Long64_t kPrefetchCacheBytes = 32LL * 1024 * 1024;
 
 bool matchesValue(const std::optional<std::string> &selector, const std::string &value) {
     return !selector || value == *selector;
@@ -60,10 +84,171 @@ std::optional<std::string> normaliseSelectorValue(const std::string &value) {
     return value;
 }
 
+std::optional<std::set<std::string>> referencedFriendLabels(const std::optional<std::vector<std::string>> &columns) {
+    if (!columns) {
+        return std::nullopt;
+    }
+    std::set<std::string> labels;
+    for (const auto &column : *columns) {
+        const auto dot = column.find('.');
+        if (dot != std::string::npos && dot > 0) {
+            labels.insert(column.substr(0, dot));
+        }
+    }
+    return labels;
+}
+
+// Cache key of a bundle: the entry ids, the zone-map flags and the attached friend labels.
+std::string makeBundleKey(const std::vector<const proc::HubDataFrame::CatalogEntry *> &entries,
+                          const std::vector<std::string> &flags,
+                          const std::optional<std::set<std::string>> &friend_labels) {
+    std::vector<std::uint32_t> ids;
+    ids.reserve(entries.size());
+    for (const auto *entry : entries) {
+        ids.push_back(entry->entry_id);
+    }
+    std::sort(ids.begin(), ids.end());
+
+    std::string key;
+    key.reserve(ids.size() * 6);
+    for (const auto id : ids) {
+        key.append(std::to_string(id));
+        key.push_back(',');
+    }
+    for (const auto &flag : flags) {
+        key.append("|").append(flag);
+    }
+    if (friend_labels) {
+        key.append("#");
+        for (const auto &label : *friend_labels) {
+            key.append(label).append(",");
+        }
+    }
+    return key;
+}
+
 } // namespace
 
 namespace proc {
 
+// Background warm-up of upcoming chain elements. Each group holds the dataset file of one
+// catalog entry together with its friend files; the event loop reports the group it has
+// reached and the worker keeps the following groups warm. The warm-up reads go through the
+// OS page cache, so the chain's own reads of those baskets no longer wait on storage.
+class HubDataFrame::Prefetcher {
+  public:
+    struct File {
+        std::string path;
+        std::string tree;
+    };
+    using Group = std::vector<File>;
+
+    Prefetcher(std::vector<Group> groups, std::size_t depth)
+        : groups_(std::move(groups)), depth_(depth), target_(std::min(depth, groups_.size())) {
+        for (std::size_t i = 0; i < groups_.size(); ++i) {
+            if (!groups_[i].empty()) {
+                group_index_.emplace(groups_[i].front().path, i);
+            }
+        }
+        worker_ = std::thread([this] { this->run(); });
+    }
+
+    ~Prefetcher() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        worker_.join();
+    }
+
+    Prefetcher(const Prefetcher &) = delete;
+    Prefetcher &operator=(const Prefetcher &) = delete;
+
+    // Sample identifiers are "<file>/<tree>" as reported by RSampleInfo.
+    void advance(const std::string &sample_id) {
+        const auto slash = sample_id.rfind('/');
+        const auto path = slash == std::string::npos ? sample_id : sample_id.substr(0, slash);
+        const auto it = group_index_.find(path);
+        if (it == group_index_.end()) {
+            return;
+        }
+        const std::size_t index = it->second;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            const std::size_t window_end = std::min(index + 1 + depth_, groups_.size());
+            const std::size_t position = position_.load();
+            if (position != kNoPosition && index < position) {
+                // A new event loop over the cached chain: warm the window ahead of it again.
+                // Out-of-order reports under implicit MT at worst re-read cached groups.
+                next_ = index + 1;
+                target_ = window_end;
+            } else {
+                target_ = std::max(target_, window_end);
+            }
+            position_ = index;
+        }
+        wake_.notify_one();
+    }
+
+  private:
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            wake_.wait(lock, [this] { return stop_ || next_ < target_; });
+            if (stop_) {
+                return;
+            }
+            const std::size_t index = next_++;
+            lock.unlock();
+            for (const auto &file : groups_[index]) {
+                warm(index, file);
+            }
+            lock.lock();
+        }
+    }
+
+    // Reads the tree cluster by cluster until the event loop reaches the group itself.
+    void warm(std::size_t group, const File &file) const {
+        std::unique_ptr<TFile> handle(TFile::Open(file.path.c_str(), "READ"));
+        if (!handle || handle->IsZombie()) {
+            return;
+        }
+        auto *tree = handle->Get<TTree>(file.tree.c_str());
+        if (!tree || tree->GetEntries() == 0) {
+            return;
+        }
+        const Long64_t entries = tree->GetEntries();
+        tree->SetCacheSize(kPrefetchCacheBytes);
+        tree->AddBranchToCache("*", true);
+        tree->StopCacheLearningPhase();
+        auto clusters = tree->GetClusterIterator(0);
+        Long64_t cluster_start = 0;
+        while ((cluster_start = clusters()) < entries) {
+            const std::size_t position = position_.load();
+            if (stop_ || (position != kNoPosition && position >= group)) {
+                return;
+            }
+            tree->SetCacheEntryRange(cluster_start, std::min(clusters.GetNextEntry(), entries));
+            tree->GetEntry(cluster_start);
+        }
+    }
+
+    static constexpr std::size_t kNoPosition = static_cast<std::size_t>(-1);
+
+    const std::vector<Group> groups_;
+    const std::size_t depth_;
+    std::unordered_map<std::string, std::size_t> group_index_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::size_t next_ = 0;
+    std::size_t target_ = 0;
+    // Group the event loop last reported, kNoPosition before the first report.
+    std::atomic<std::size_t> position_{kNoPosition};
+    std::atomic<bool> stop_{false};
+    std::thread worker_;
+};
+
 HubDataFrame::Selection::Selection(HubDataFrame &owner)
     : owner_(owner), variation_(std::string{"nominal"}) {}
 
@@ -127,24 +312,213 @@ HubDataFrame::Selection &HubDataFrame::Selection::clearStage() {
     return *this;
 }
 
+HubDataFrame::Selection &HubDataFrame::Selection::require(const std::string &flag) {
+    if (!flag.empty() && std::find(flags_.begin(), flags_.end(), flag) == flags_.end()) {
+        flags_.push_back(flag);
+    }
+    return *this;
+}
+
+HubDataFrame::Selection &HubDataFrame::Selection::category(const std::string &column, int value) {
+    if (!column.empty()) {
+        categories_.emplace_back(column, value);
+    }
+    return *this;
+}
+
+HubDataFrame::Selection &HubDataFrame::Selection::clearPredicates() {
+    flags_.clear();
+    categories_.clear();
+    return *this;
+}
+
+ROOT::RDF::RNode HubDataFrame::Selection::loadFriend(const std::string &label) {
+    return owner_.loadFriendFrame(entries(), label);
+}
+
+HubDataFrame::Selection &HubDataFrame::Selection::columns(const std::vector<std::string> &names) {
+    columns_ = names;
+    return *this;
+}
+
+HubDataFrame::Selection &HubDataFrame::Selection::clearColumns() {
+    columns_.reset();
+    return *this;
+}
+
 std::vector<const HubDataFrame::CatalogEntry *> HubDataFrame::Selection::entries() const {
-    return owner_.resolveEntries(sample_, beam_, period_, variation_, origin_, stage_);
+    return HubDataFrame::pruneEntries(owner_.resolveEntries(sample_, beam_, period_, variation_, origin_, stage_),
+                                      flags_, categories_);
+}
+
+std::vector<const HubDataFrame::CatalogEntry *> HubDataFrame::Selection::chainEntries() const {
+    return owner_.alignCompactedGroups(entries());
+}
+
+std::vector<std::pair<std::string, std::string>> HubDataFrame::Selection::datasetTrees() const {
+    std::vector<std::pair<std::string, std::string>> trees;
+    for (const auto *entry : chainEntries()) {
+        trees.emplace_back(owner_.resolveDatasetPath(*entry).string(), entry->dataset_tree);
+    }
+    return trees;
 }
 
 ROOT::RDF::RNode HubDataFrame::Selection::load() {
-    return owner_.loadSelection(sample_, beam_, period_, variation_, origin_, stage_);
+    return owner_.loadSelection(sample_, beam_, period_, variation_, origin_, stage_, flags_, categories_, columns_);
+}
+
+std::optional<std::uint64_t> HubDataFrame::Selection::count() const {
+    if (flags_.size() + categories_.size() > 1) {
+        return std::nullopt;
+    }
+
+    std::uint64_t total = 0ULL;
+    for (const auto *entry : owner_.resolveEntries(sample_, beam_, period_, variation_, origin_, stage_)) {
+        const auto &zone_map = entry->zone_map;
+        if (!flags_.empty()) {
+            auto it = zone_map.pass_counts.find(flags_.front());
+            if (!zone_map.available || it == zone_map.pass_counts.end()) {
+                return std::nullopt;
+            }
+            total += it->second;
+        } else if (!categories_.empty()) {
+            const auto &[column, value] = categories_.front();
+            auto it = zone_map.category_counts.find(column);
+            if (!zone_map.available || it == zone_map.category_counts.end()) {
+                return std::nullopt;
+            }
+            auto code = it->second.find(value);
+            total += (code == it->second.end()) ? 0ULL : code->second;
+        } else {
+            total += entry->n_events;
+        }
+    }
+    return total;
+}
+
+std::optional<double> HubDataFrame::Selection::yield() const {
+    if (!categories_.empty() || flags_.size() > 1) {
+        return std::nullopt;
+    }
+
+    double total = 0.0;
+    for (const auto *entry : owner_.resolveEntries(sample_, beam_, period_, variation_, origin_, stage_)) {
+        if (flags_.empty()) {
+            total += entry->sum_weights;
+            continue;
+        }
+        const auto &zone_map = entry->zone_map;
+        auto it = zone_map.pass_yields.find(flags_.front());
+        if (!zone_map.available || it == zone_map.pass_yields.end()) {
+            return std::nullopt;
+        }
+        total += it->second;
+    }
+    return total;
 }
 
 HubDataFrame::HubDataFrame(const std::string &hub_path)
     : hub_path_(hub_path),
       hub_directory_(
-          std::filesystem::absolute(std::filesystem::path(hub_path)).parent_path().string()) {
+          std::filesystem::absolute(std::filesystem::path(hub_path)).parent_path().string()),
+      chain_cache_(std::make_unique<ChainCache>()) {
+    ROOT::EnableThreadSafety();
     this->loadMetadata();
     this->loadCatalog();
+    hubs_.push_back(HubSource{hub_path_, hub_directory_, summary_.resolved_base_directory});
+}
+
+HubDataFrame::HubDataFrame(const std::vector<std::string> &hub_paths)
+    : HubDataFrame(hub_paths.empty() ? throw std::runtime_error("HubDataFrame requires at least one hub file")
+                                     : hub_paths.front()) {
+    for (std::size_t i = 1; i < hub_paths.size(); ++i) {
+        this->mergeHub(HubDataFrame(hub_paths[i]));
+    }
+    if (hub_paths.size() > 1) {
+        log::info("HubDataFrame", "Federated", hub_paths.size(), "hubs with", entries_.size(), "catalog entries");
+    }
 }
 
 HubDataFrame::Selection HubDataFrame::select() { return Selection(*this); }
 
+std::vector<ROOT::RDF::RNode> HubDataFrame::loadMany(const std::vector<Selection> &selections) {
+    std::vector<Selection> pending(selections);
+
+    // Identical selections share one node, so only the first occurrence of each key is built.
+    std::vector<std::string> keys;
+    keys.reserve(pending.size());
+    for (const auto &selection : pending) {
+        auto entries = resolveEntries(selection.sample_, selection.beam_, selection.period_, selection.variation_,
+                                      selection.origin_, selection.stage_);
+        if (entries.empty()) {
+            throw std::runtime_error("No hub entries matched the requested selection");
+        }
+        std::string key =
+            makeBundleKey(entries, selection.flags_, referencedFriendLabels(selection.columns_));
+        for (const auto &[column, value] : selection.categories_) {
+            key.append("|").append(column).append("=").append(std::to_string(value));
+        }
+        keys.push_back(std::move(key));
+    }
+
+    std::unordered_map<std::string, std::size_t> first_index;
+    std::vector<std::size_t> distinct;
+    for (std::size_t idx = 0; idx < pending.size(); ++idx) {
+        if (first_index.emplace(keys[idx], idx).second) {
+            distinct.push_back(idx);
+        }
+    }
+
+    // A fixed pool builds the distinct selections, so a release with many variations does
+    // not open all of its chains at once.
+    std::vector<std::optional<ROOT::RDF::RNode>> built(pending.size());
+    std::atomic<std::size_t> next{0};
+    std::mutex error_mutex;
+    std::exception_ptr error;
+    auto work = [&]() {
+        for (std::size_t job = next++; job < distinct.size(); job = next++) {
+            try {
+                built[distinct[job]] = pending[distinct[job]].load();
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                next = distinct.size();
+            }
+        }
+    };
+    const std::size_t n_threads =
+        std::min<std::size_t>(distinct.size(), std::max(1U, std::thread::hardware_concurrency()));
+    std::vector<std::thread> workers;
+    for (std::size_t i = 1; i < n_threads; ++i) {
+        workers.emplace_back(work);
+    }
+    work();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+
+    std::vector<ROOT::RDF::RNode> nodes;
+    nodes.reserve(pending.size());
+    for (std::size_t idx = 0; idx < pending.size(); ++idx) {
+        nodes.push_back(*built[first_index.at(keys[idx])]);
+    }
+
+    log::info("HubDataFrame", "Loaded", nodes.size(), "selections backed by", first_index.size(), "distinct nodes");
+    return nodes;
+}
+
+unsigned int HubDataFrame::runAll(std::vector<ROOT::RDF::RResultHandle> handles) {
+    if (handles.empty()) {
+        return 0U;
+    }
+    return ROOT::RDF::RunGraphs(std::move(handles));
+}
+
 ROOT::RDF::RNode HubDataFrame::query(const std::string &beam, const std::string &period,
                                      const std::string &variation, const std::string &origin,
                                      const std::string &stage) {
@@ -203,21 +577,411 @@ ROOT::RDF::RNode HubDataFrame::loadSelection(const std::optional<std::string> &s
                                              const std::optional<std::string> &period,
                                              const std::optional<std::string> &variation,
                                              const std::optional<std::string> &origin,
-                                             const std::optional<std::string> &stage) {
+                                             const std::optional<std::string> &stage,
+                                             const std::vector<std::string> &flags,
+                                             const std::vector<std::pair<std::string, int>> &categories,
+                                             const std::optional<std::vector<std::string>> &columns) {
     auto matches = resolveEntries(sample, beam, period, variation, origin, stage);
     if (matches.empty()) {
         throw std::runtime_error("No hub entries matched the requested selection");
     }
-    return buildDataFrame(matches);
+
+    auto pruned = pruneEntries(matches, flags, categories);
+    if (pruned.size() < matches.size()) {
+        log::info("HubDataFrame", "Zone maps skipped", matches.size() - pruned.size(), "of", matches.size(),
+                  "entries");
+        std::unordered_set<const CatalogEntry *> kept(pruned.begin(), pruned.end());
+        pruned.clear();
+        for (const auto *entry : matches) {
+            const auto group = compactedGroup(*entry);
+            if (std::any_of(group.begin(), group.end(), [&](const CatalogEntry *member) { return kept.count(member); })) {
+                pruned.push_back(entry);
+            }
+        }
+    }
+    if (pruned.empty()) {
+        // Keep one entry so the node still exposes the schema; the filters below reject every event.
+        pruned.push_back(matches.front());
+    }
+
+    BundleOptions options;
+    options.flags = flags;
+    options.friend_labels = referencedFriendLabels(columns);
+
+    auto node = buildDataFrame(pruned, options);
+    for (const auto &flag : flags) {
+        node = node.Filter([](bool value) { return value; }, {flag});
+    }
+    for (const auto &[column, value] : categories) {
+        const int code = value;
+        node = node.Filter([code](int category) { return category == code; }, {column});
+    }
+    return node;
+}
+
+std::vector<const HubDataFrame::CatalogEntry *> HubDataFrame::pruneEntries(
+    const std::vector<const CatalogEntry *> &entries, const std::vector<std::string> &flags,
+    const std::vector<std::pair<std::string, int>> &categories) {
+    if (flags.empty() && categories.empty()) {
+        return entries;
+    }
+
+    std::vector<const CatalogEntry *> kept;
+    kept.reserve(entries.size());
+    for (const auto *entry : entries) {
+        const auto &zone_map = entry->zone_map;
+        bool possible = true;
+        if (zone_map.available) {
+            for (const auto &flag : flags) {
+                auto it = zone_map.pass_counts.find(flag);
+                if (it != zone_map.pass_counts.end() && it->second == 0ULL) {
+                    possible = false;
+                }
+            }
+            for (const auto &[column, value] : categories) {
+                auto it = zone_map.category_counts.find(column);
+                if (it != zone_map.category_counts.end() && it->second.count(value) == 0U) {
+                    possible = false;
+                }
+            }
+        }
+        if (possible) {
+            kept.push_back(entry);
+        }
+    }
+    return kept;
 }
 
-ROOT::RDF::RNode HubDataFrame::buildDataFrame(const std::vector<const CatalogEntry *> &entries) {
+ROOT::RDF::RNode HubDataFrame::buildDataFrame(const std::vector<const CatalogEntry *> &entries,
+                                              const BundleOptions &options) {
     if (entries.empty()) {
         throw std::runtime_error("No hub entries matched the requested selection");
     }
 
+    return makeNode(acquireBundle(entries, options));
+}
+
+std::uint64_t HubDataFrame::friendOffset(const CatalogEntry &entry) {
+    for (const auto &info : entry.friends) {
+        if (info.label.empty()) {
+            return info.entry_offset;
+        }
+    }
+    return 0ULL;
+}
+
+std::vector<const HubDataFrame::CatalogEntry *> HubDataFrame::compactedGroup(const CatalogEntry &entry) const {
+    std::vector<const CatalogEntry *> group;
+    if (entry.friend_path.empty()) {
+        group.push_back(&entry);
+        return group;
+    }
+    for (const auto &candidate : entries_) {
+        if (candidate.hub_index == entry.hub_index && candidate.friend_path == entry.friend_path) {
+            group.push_back(&candidate);
+        }
+    }
+    std::stable_sort(group.begin(), group.end(), [](const CatalogEntry *a, const CatalogEntry *b) {
+        return friendOffset(*a) < friendOffset(*b);
+    });
+    return group;
+}
+
+std::vector<const HubDataFrame::CatalogEntry *> HubDataFrame::alignCompactedGroups(
+    const std::vector<const CatalogEntry *> &entries) const {
+    const std::unordered_set<const CatalogEntry *> selected(entries.begin(), entries.end());
+    std::unordered_set<const CatalogEntry *> placed;
+    std::vector<const CatalogEntry *> ordered;
+    ordered.reserve(entries.size());
+    for (const auto *entry : entries) {
+        if (placed.count(entry)) {
+            continue;
+        }
+        for (const auto *member : compactedGroup(*entry)) {
+            if (!selected.count(member)) {
+                throw std::runtime_error("Selection covers only part of the compacted friend " + entry->friend_path +
+                                         "; select every entry that shares it");
+            }
+            ordered.push_back(member);
+            placed.insert(member);
+        }
+    }
+    return ordered;
+}
+
+ROOT::RDF::RNode HubDataFrame::loadFriendFrame(const std::vector<const CatalogEntry *> &entries,
+                                              const std::string &label) const {
+    std::string tree;
+    std::vector<std::string> paths;
+    paths.reserve(entries.size());
+    auto pins = std::make_shared<LocalFileCache::PinSet>();
+    for (const auto *entry : alignCompactedGroups(entries)) {
+        const auto it = std::find_if(entry->friends.begin(), entry->friends.end(),
+                                     [&](const CatalogEntry::FriendInfo &info) { return info.label == label; });
+        if (it == entry->friends.end() || it->path.empty()) {
+            throw std::runtime_error("Hub entry " + std::to_string(entry->entry_id) + " has no friend labelled '" +
+                                     label + "'");
+        }
+        if (tree.empty()) {
+            tree = it->tree;
+        } else if (tree != it->tree) {
+            log::info("HubDataFrame", "[warning]", "Friend", label, "uses mixed tree names; using", tree);
+        }
+        auto path = resolveFriendPath(*entry, it->path, pins.get()).string();
+        if (paths.empty() || paths.back() != path) {
+            paths.push_back(std::move(path));
+        }
+    }
+    if (paths.empty()) {
+        throw std::runtime_error("No hub entries matched the requested selection");
+    }
+    // The file-based constructor detects TTree and RNTuple inputs alike. The pass-through
+    // filter keeps mirrored copies pinned for as long as the frame lives.
+    ROOT::RDF::RNode frame = ROOT::RDataFrame(tree, paths);
+    if (pins->empty()) {
+        return frame;
+    }
+    return frame.Filter([pins] { return true; }, {});
+}
+
+ROOT::RDF::RNode HubDataFrame::makeNode(const std::shared_ptr<ChainBundle> &bundle) {
+    // Every node gets its own RDataFrame over the cached chain, so results booked on one load()
+    // never ride along with another's event loop. The pass-through filter holds a reference to
+    // the bundle so that the chains outlive every node (and every booked result) derived from
+    // it, even after cache eviction.
+    ROOT::RDF::RNode root = unpackColumns(ROOT::RDataFrame(*bundle->chain), bundle->packed_columns);
+    if (!bundle->prefetcher) {
+        return root.Filter([bundle]() { return true; });
+    }
+    return root
+        .DefinePerSample(kPrefetchColumn,
+                         [bundle](unsigned int, const ROOT::RDF::RSampleInfo &info) {
+                             bundle->prefetcher->advance(info.AsString());
+                             return 0;
+                         })
+        .Filter([bundle](int) { return true; }, {kPrefetchColumn});
+}
+
+std::vector<HubDataFrame::PackedColumn> HubDataFrame::readPackedLayout(const std::string &path,
+                                                                       const std::string &tree_name) {
+    std::vector<PackedColumn> layout;
+    std::unique_ptr<TFile> file(TFile::Open(path.c_str(), "READ"));
+    auto *table = (file && !file->IsZombie()) ? file->Get<TTree>((tree_name + kLayoutSuffix).c_str()) : nullptr;
+    if (!table) {
+        return layout;
+    }
+    TTreeReader reader(table);
+    TTreeReaderValue<std::string> column(reader, "column");
+    TTreeReaderValue<std::string> encoding(reader, "encoding");
+    TTreeReaderValue<std::string> source(reader, "source");
+    TTreeReaderValue<int> bit(reader, "bit");
+    while (reader.Next()) {
+        layout.push_back(PackedColumn{*column, *encoding, *source, *bit});
+    }
+    return layout;
+}
+
+ROOT::RDF::RNode HubDataFrame::unpackColumns(ROOT::RDF::RNode node, const std::vector<PackedColumn> &layout) {
+    for (const auto &packed : layout) {
+        if (packed.encoding == "bit") {
+            const UInt_t mask = 1U << packed.bit;
+            node = node.Define(packed.column, [mask](UInt_t word) { return (word & mask) != 0U; }, {packed.source});
+        } else if (packed.encoding == "uint8") {
+            const int offset = packed.bit;
+            node = node.Define(packed.column, [offset](UChar_t value) { return static_cast<int>(value) - offset; },
+                               {packed.source});
+        } else if (packed.encoding == "int8") {
+            node = node.Define(packed.column, [](Char_t value) { return static_cast<int>(value); }, {packed.source});
+        } else if (packed.encoding == "bitarray") {
+            node = node.Define(packed.column,
+                               [](const ROOT::RVec<UChar_t> &bytes) {
+                                   ROOT::RVec<bool> values;
+                                   if (bytes.empty() || bytes.back() == 0U) {
+                                       return values;
+                                   }
+                                   // The highest set bit of the last byte is the stop bit.
+                                   std::size_t stop = 7U;
+                                   while ((bytes.back() & (1U << stop)) == 0U) {
+                                       --stop;
+                                   }
+                                   values.resize((bytes.size() - 1U) * 8U + stop);
+                                   for (std::size_t idx = 0; idx < values.size(); ++idx) {
+                                       values[idx] = ((bytes[idx / 8U] >> (idx % 8U)) & 1U) != 0U;
+                                   }
+                                   return values;
+                               },
+                               {packed.source});
+        } else if (packed.column == "event_uid") {
+            // Mirrors how the snapshot defined it. FriendWriter only drops uids built from
+            // run/sub/evt, so a dataset without them cannot be read with this friend.
+            if (!node.HasColumn("run") || !node.HasColumn("sub") || !node.HasColumn("evt")) {
+                throw std::runtime_error("The packed friend derives event_uid from run/sub/evt, which the dataset "
+                                         "tree does not have");
+            }
+            node = node.Define(packed.column, makeEventUid, {"run", "sub", "evt"});
+        } else {
+            log::info("HubDataFrame", "[warning]", "Unknown packed encoding", packed.encoding, "for", packed.column);
+        }
+    }
+    return node;
+}
+
+std::optional<HubDataFrame::EventLocation> HubDataFrame::locateEvent(std::uint64_t event_uid) const {
+    for (const auto &entry : entries_) {
+        if (entry.n_events == 0ULL || event_uid < entry.first_event_uid || event_uid > entry.last_event_uid) {
+            continue;
+        }
+        if (auto tree_entry = searchUidIndex(entry, event_uid)) {
+            return EventLocation{&entry, *tree_entry};
+        }
+    }
+    return std::nullopt;
+}
+
+std::optional<ROOT::RDF::RNode> HubDataFrame::findEvent(std::uint64_t event_uid) {
+    const auto location = locateEvent(event_uid);
+    if (!location) {
+        log::info("HubDataFrame", "[warning]", "No hub entry contains event_uid", event_uid);
+        return std::nullopt;
+    }
+
+    const CatalogEntry &entry = *location->entry;
+    const std::string dataset_tree = entry.dataset_tree.empty() ? std::string{"events"} : entry.dataset_tree;
+    auto bundle = buildBundle(compactedGroup(entry), BundleOptions{});
+    bundle->entry_list = std::make_unique<TEntryList>("hub_event_lookup", "Single event lookup");
+    TEntryList sublist("", "", dataset_tree.c_str(), resolveDatasetPath(entry).string().c_str());
+    sublist.Enter(location->tree_entry);
+    bundle->entry_list->Add(&sublist);
+    bundle->chain->SetEntryList(bundle->entry_list.get());
+
+    log::info("HubDataFrame", "Found event_uid", event_uid, "at entry", location->tree_entry, "of", entry.sample_key,
+              entry.variation);
+    return makeNode(bundle);
+}
+
+std::optional<Long64_t> HubDataFrame::searchUidIndex(const CatalogEntry &entry, std::uint64_t event_uid) const {
+    if (entry.friend_path.empty()) {
+        return std::nullopt;
+    }
+    // Rows of a compacted friend are numbered across the whole merged file.
+    const auto offset = static_cast<Long64_t>(friendOffset(entry));
+    auto toLocal = [&](Long64_t row) -> std::optional<Long64_t> {
+        const Long64_t local = row - offset;
+        if (local < 0 || (entry.n_events > 0ULL && local >= static_cast<Long64_t>(entry.n_events))) {
+            return std::nullopt;
+        }
+        return local;
+    };
+
+    LocalFileCache::PinSet pins;
+    const auto path = resolveFriendPath(entry, &pins);
+    std::unique_ptr<TFile> file(TFile::Open(path.string().c_str(), "READ"));
+    if (!file || file->IsZombie()) {
+        return std::nullopt;
+    }
+
+    auto *index = file->Get<TTree>((entry.friend_tree + kUidIndexSuffix).c_str());
+    if (!index) {
+        // Friends written before the index existed are scanned instead.
+        auto *tree = file->Get<TTree>(entry.friend_tree.c_str());
+        if (!tree || !tree->GetBranch("event_uid")) {
+            return std::nullopt;
+        }
+        log::info("HubDataFrame", "[debug]", "No uid index in", path.string(), "; scanning event_uid");
+        TTreeReader reader(tree);
+        TTreeReaderValue<ULong64_t> uid(reader, "event_uid");
+        while (reader.Next()) {
+            if (*uid == event_uid) {
+                if (auto local = toLocal(reader.GetCurrentEntry())) {
+                    return local;
+                }
+            }
+        }
+        return std::nullopt;
+    }
+
+    ULong64_t uid = 0ULL;
+    Long64_t tree_entry = -1;
+    index->SetBranchAddress("event_uid", &uid);
+    index->SetBranchAddress("entry", &tree_entry);
+
+    Long64_t low = 0;
+    Long64_t high = index->GetEntries();
+    while (low < high) {
+        const Long64_t mid = low + (high - low) / 2;
+        index->GetEntry(mid);
+        if (uid < event_uid) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low >= index->GetEntries()) {
+        return std::nullopt;
+    }
+    for (; low < index->GetEntries(); ++low) {
+        index->GetEntry(low);
+        if (uid != event_uid) {
+            break;
+        }
+        if (auto local = toLocal(tree_entry)) {
+            return local;
+        }
+    }
+    return std::nullopt;
+}
+
+std::shared_ptr<HubDataFrame::ChainBundle> HubDataFrame::acquireBundle(const std::vector<const CatalogEntry *> &entries,
+                                                                       const BundleOptions &options) {
+    const std::string key = makeBundleKey(entries, options.flags, options.friend_labels);
+    auto &cache = *chain_cache_;
+
+    {
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        auto it = cache.index.find(key);
+        if (it != cache.index.end()) {
+            cache.lru.splice(cache.lru.begin(), cache.lru, it->second);
+            log::info("HubDataFrame", "[debug]", "Reusing cached chains for", entries.size(), "entries");
+            return it->second->second;
+        }
+    }
+
+    // Chains are assembled outside the lock so that independent selections can open
+    // their files concurrently.
+    auto bundle = buildBundle(entries, options);
+
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    auto it = cache.index.find(key);
+    if (it != cache.index.end()) {
+        cache.lru.splice(cache.lru.begin(), cache.lru, it->second);
+        return it->second->second;
+    }
+    if (cache.capacity == 0) {
+        return bundle;
+    }
+    cache.lru.emplace_front(key, bundle);
+    cache.index[key] = cache.lru.begin();
+    while (cache.lru.size() > cache.capacity) {
+        cache.index.erase(cache.lru.back().first);
+        cache.lru.pop_back();
+    }
+    return bundle;
+}
+
+std::shared_ptr<HubDataFrame::ChainBundle> HubDataFrame::buildBundle(const std::vector<const CatalogEntry *> &requested,
+                                                                     const BundleOptions &options) const {
+    const auto entries = alignCompactedGroups(requested);
     const CatalogEntry &first = *entries.front();
 
+    const auto problems = checkIntegrity(entries, integrity_check_);
+    if (!problems.empty()) {
+        for (const auto &problem : problems) {
+            log::info("HubDataFrame", "[warning]", "Integrity check failed:", problem);
+        }
+        throw std::runtime_error("Hub integrity check failed for " + std::to_string(problems.size()) +
+                                 " file(s), first: " + problems.front());
+    }
+
     const std::string dataset_tree =
         first.dataset_tree.empty() ? std::string{"events"} : first.dataset_tree;
     const bool consistent_dataset_tree =
@@ -228,39 +992,57 @@ ROOT::RDF::RNode HubDataFrame::buildDataFrame(const std::vector<const CatalogEnt
         log::info("HubDataFrame", "[warning]", "Hub catalog lists mixed dataset tree names; using", dataset_tree);
     }
 
-    current_chain_ = std::make_unique<TChain>(dataset_tree.c_str());
-    friend_chains_.clear();
-    friend_chains_.reserve(4);
+    auto bundle = std::make_shared<ChainBundle>();
+    bundle->chain = std::make_unique<TChain>(dataset_tree.c_str());
+    auto &friend_chains = bundle->friends;
+    friend_chains.reserve(4);
     std::vector<std::unordered_set<std::string>> friend_chain_paths;
+    std::set<std::string> skipped_labels;
+    std::set<std::string> rntuple_labels;
+    std::vector<Prefetcher::Group> prefetch_groups;
+    std::vector<std::string> primary_friend_paths;
+    std::string primary_friend_tree;
 
     for (const auto *entry : entries) {
-        const auto dataset_path = resolveDatasetPath(*entry);
-        current_chain_->Add(dataset_path.string().c_str());
+        const auto dataset_path = resolveDatasetPath(*entry, &bundle->pins);
+        bundle->chain->Add(dataset_path.string().c_str());
+        if (prefetch_depth_ > 0) {
+            prefetch_groups.push_back({Prefetcher::File{dataset_path.string(), dataset_tree}});
+        }
 
         for (const auto &friend_info : entry->friends) {
             if (friend_info.path.empty()) {
                 continue;
             }
+            if (options.friend_labels && !friend_info.label.empty() &&
+                options.friend_labels->count(friend_info.label) == 0U) {
+                skipped_labels.insert(friend_info.label);
+                continue;
+            }
+            if (friend_info.format == kRNTupleFormat) {
+                rntuple_labels.insert(friend_info.label);
+                continue;
+            }
 
-            const auto friend_path = resolveFriendPath(friend_info.path);
+            const auto friend_path = resolveFriendPath(*entry, friend_info.path, &bundle->pins);
             if (friend_path.empty()) {
                 continue;
             }
 
             const std::string key = friend_info.tree + std::string(1, '\0') + friend_info.label;
-            auto it = std::find_if(friend_chains_.begin(), friend_chains_.end(),
+            auto it = std::find_if(friend_chains.begin(), friend_chains.end(),
                                    [&](const FriendChain &chain) { return chain.key == key; });
-            if (it == friend_chains_.end()) {
+            if (it == friend_chains.end()) {
                 FriendChain chain;
                 chain.chain = std::make_unique<TChain>(friend_info.tree.c_str());
                 chain.alias = friend_info.label;
                 chain.key = key;
-                friend_chains_.push_back(std::move(chain));
+                friend_chains.push_back(std::move(chain));
                 friend_chain_paths.emplace_back();
-                it = std::prev(friend_chains_.end());
+                it = std::prev(friend_chains.end());
             }
 
-            auto idx = static_cast<std::size_t>(std::distance(friend_chains_.begin(), it));
+            auto idx = static_cast<std::size_t>(std::distance(friend_chains.begin(), it));
             auto &path_set = friend_chain_paths[idx];
             const auto generic = friend_path.generic_string();
             if (!path_set.insert(generic).second) {
@@ -268,11 +1050,30 @@ ROOT::RDF::RNode HubDataFrame::buildDataFrame(const std::vector<const CatalogEnt
             }
 
             it->chain->Add(generic.c_str());
+            if (friend_info.label.empty()) {
+                primary_friend_paths.push_back(generic);
+                primary_friend_tree = friend_info.tree;
+            }
+            if (prefetch_depth_ > 0) {
+                prefetch_groups.back().push_back(Prefetcher::File{generic, friend_info.tree});
+            }
+        }
+    }
+
+    // A TChain cannot befriend an RNTuple, and dropping the friend would silently lose its
+    // columns (w_nom and the zone-map flags for the primary one).
+    if (!rntuple_labels.empty()) {
+        std::string names;
+        for (const auto &label : rntuple_labels) {
+            names += (names.empty() ? "" : ", ") + (label.empty() ? std::string{"(primary)"} : label);
         }
+        throw std::runtime_error("Friends stored as RNTuple cannot join the dataset chain: " + names +
+                                 ". Leave labelled ones out with Selection::columns() and read them with "
+                                 "Selection::loadFriend, or rewrite them as TTree");
     }
 
     int attached_friends = 0;
-    for (auto &friend_chain : friend_chains_) {
+    for (auto &friend_chain : friend_chains) {
         if (!friend_chain.chain) {
             continue;
         }
@@ -280,30 +1081,341 @@ ROOT::RDF::RNode HubDataFrame::buildDataFrame(const std::vector<const CatalogEnt
             continue;
         }
         if (!friend_chain.alias.empty()) {
-            current_chain_->AddFriend(friend_chain.chain.get(), friend_chain.alias.c_str());
+            bundle->chain->AddFriend(friend_chain.chain.get(), friend_chain.alias.c_str());
         } else {
-            current_chain_->AddFriend(friend_chain.chain.get());
+            bundle->chain->AddFriend(friend_chain.chain.get());
         }
         ++attached_friends;
     }
 
+    for (const auto &label : skipped_labels) {
+        log::info("HubDataFrame", "[debug]", "Friend", label, "is not referenced; leaving it unattached");
+    }
+
     if (attached_friends == 0) {
         log::info("HubDataFrame", "[warning]", "No friend trees available for selection", first.beam, first.period,
                   first.variation, first.origin, first.stage);
     }
 
+    if (!options.flags.empty()) {
+        bundle->entry_list = buildClusterEntryList(entries, options.flags, dataset_tree);
+        if (bundle->entry_list) {
+            bundle->chain->SetEntryList(bundle->entry_list.get());
+        }
+    }
+
+    // One set of Defines unpacks the whole chain, so every primary friend must share a layout.
+    // FriendWriter decides it once per hub; hubs written before that may mix layouts.
+    for (std::size_t i = 0; i < primary_friend_paths.size(); ++i) {
+        auto layout = readPackedLayout(primary_friend_paths[i], primary_friend_tree);
+        if (i == 0U) {
+            bundle->packed_columns = std::move(layout);
+            continue;
+        }
+        const bool same = std::equal(layout.begin(), layout.end(), bundle->packed_columns.begin(),
+                                     bundle->packed_columns.end(), [](const PackedColumn &a, const PackedColumn &b) {
+                                         return a.column == b.column && a.encoding == b.encoding &&
+                                                a.source == b.source && a.bit == b.bit;
+                                     });
+        if (!same) {
+            throw std::runtime_error("Friend files " + primary_friend_paths.front() + " and " +
+                                     primary_friend_paths[i] +
+                                     " use different packed layouts and cannot be chained; rewrite the hub");
+        }
+    }
+
+    if (prefetch_depth_ > 0) {
+        bundle->prefetcher = std::make_shared<Prefetcher>(std::move(prefetch_groups), prefetch_depth_);
+    }
+
     log::info("HubDataFrame", "Loaded", entries.size(), "entries for", first.beam, first.period, first.variation,
               first.origin, first.stage);
-    return ROOT::RDataFrame(*current_chain_);
+    return bundle;
+}
+
+std::unique_ptr<TEntryList> HubDataFrame::buildClusterEntryList(const std::vector<const CatalogEntry *> &entries,
+                                                                const std::vector<std::string> &flags,
+                                                                const std::string &dataset_tree) const {
+    auto entry_list = std::make_unique<TEntryList>("hub_cluster_selection", "Clusters passing the zone maps");
+    std::uint64_t total = 0ULL;
+    std::uint64_t kept = 0ULL;
+
+    for (const auto *entry : entries) {
+        const auto dataset_path = resolveDatasetPath(*entry).string();
+        TEntryList sublist("", "", dataset_tree.c_str(), dataset_path.c_str());
+
+        const auto clusters = readPassingClusters(*entry, flags);
+        if (clusters) {
+            for (const auto &[begin, end] : *clusters) {
+                sublist.EnterRange(begin, end);
+                kept += static_cast<std::uint64_t>(end - begin);
+            }
+        } else {
+            // Without a cluster table the whole entry is read; that needs its length.
+            if (entry->n_events == 0ULL) {
+                return nullptr;
+            }
+            sublist.EnterRange(0, static_cast<Long64_t>(entry->n_events));
+            kept += entry->n_events;
+        }
+        total += entry->n_events;
+        entry_list->Add(&sublist);
+    }
+
+    if (kept >= total) {
+        return nullptr;
+    }
+    log::info("HubDataFrame", "Cluster zone maps restrict the event loop to", kept, "of", total, "events");
+    return entry_list;
+}
+
+std::optional<std::vector<std::pair<Long64_t, Long64_t>>> HubDataFrame::readPassingClusters(
+    const CatalogEntry &entry, const std::vector<std::string> &flags) const {
+    if (entry.friend_path.empty()) {
+        return std::nullopt;
+    }
+
+    LocalFileCache::PinSet pins;
+    const auto path = resolveFriendPath(entry, &pins);
+    std::unique_ptr<TFile> file(TFile::Open(path.string().c_str(), "READ"));
+    if (!file || file->IsZombie()) {
+        return std::nullopt;
+    }
+    auto *table = file->Get<TTree>((entry.friend_tree + kClusterTableSuffix).c_str());
+    if (!table) {
+        return std::nullopt;
+    }
+    for (const auto &flag : flags) {
+        if (!table->GetBranch((flag + "_count").c_str())) {
+            return std::nullopt;
+        }
+    }
+
+    TTreeReader reader(table);
+    TTreeReaderValue<Long64_t> entry_begin(reader, "entry_begin");
+    TTreeReaderValue<Long64_t> entry_end(reader, "entry_end");
+    std::vector<std::unique_ptr<TTreeReaderValue<Long64_t>>> counts;
+    for (const auto &flag : flags) {
+        counts.push_back(std::make_unique<TTreeReaderValue<Long64_t>>(reader, (flag + "_count").c_str()));
+    }
+
+    std::vector<std::pair<Long64_t, Long64_t>> ranges;
+    while (reader.Next()) {
+        const bool passing = std::all_of(counts.begin(), counts.end(),
+                                         [](const auto &count) { return **count > 0; });
+        if (!passing) {
+            continue;
+        }
+        if (!ranges.empty() && ranges.back().second == *entry_begin) {
+            ranges.back().second = *entry_end;
+        } else {
+            ranges.emplace_back(*entry_begin, *entry_end);
+        }
+    }
+
+    // A compacted friend holds several entries; keep this entry's rows in local numbering.
+    const auto offset = static_cast<Long64_t>(friendOffset(entry));
+    if (offset == 0 && compactedGroup(entry).size() == 1U) {
+        return ranges;
+    }
+    const auto limit = offset + static_cast<Long64_t>(entry.n_events);
+    std::vector<std::pair<Long64_t, Long64_t>> local;
+    for (const auto &[begin, end] : ranges) {
+        const auto clipped_begin = std::max(begin, offset);
+        const auto clipped_end = std::min(end, limit);
+        if (clipped_begin < clipped_end) {
+            local.emplace_back(clipped_begin - offset, clipped_end - offset);
+        }
+    }
+    return local;
+}
+
+void HubDataFrame::setChainCacheCapacity(std::size_t capacity) {
+    std::lock_guard<std::mutex> lock(chain_cache_->mutex);
+    chain_cache_->capacity = capacity;
+    while (chain_cache_->lru.size() > capacity) {
+        chain_cache_->index.erase(chain_cache_->lru.back().first);
+        chain_cache_->lru.pop_back();
+    }
+}
+
+std::size_t HubDataFrame::chainCacheCapacity() const {
+    std::lock_guard<std::mutex> lock(chain_cache_->mutex);
+    return chain_cache_->capacity;
+}
+
+std::size_t HubDataFrame::cachedChainCount() const {
+    std::lock_guard<std::mutex> lock(chain_cache_->mutex);
+    return chain_cache_->lru.size();
+}
+
+void HubDataFrame::clearChainCache() {
+    std::lock_guard<std::mutex> lock(chain_cache_->mutex);
+    chain_cache_->lru.clear();
+    chain_cache_->index.clear();
+}
+
+void HubDataFrame::setPrefetchDepth(std::size_t files) {
+    if (files == prefetch_depth_) {
+        return;
+    }
+    prefetch_depth_ = files;
+    // Cached bundles were built with the previous depth.
+    this->clearChainCache();
+}
+
+std::vector<std::string> HubDataFrame::verify(IntegrityCheck level) const {
+    std::vector<const CatalogEntry *> entries;
+    entries.reserve(entries_.size());
+    for (const auto &entry : entries_) {
+        entries.push_back(&entry);
+    }
+    return checkIntegrity(entries, level);
+}
+
+// Every file is checked once, even when compacted entries share it. Checks run on a small
+// pool of threads since each mostly waits on the file system.
+std::vector<std::string> HubDataFrame::checkIntegrity(const std::vector<const CatalogEntry *> &entries,
+                                                      IntegrityCheck level) const {
+    if (level == IntegrityCheck::kNone) {
+        return {};
+    }
+
+    struct FileRecord {
+        std::string tree;
+        bool rntuple = false;
+        std::uint64_t bytes = 0ULL;
+        std::uint64_t checksum = 0ULL;
+        std::uint64_t rows = 0ULL;
+        bool counted = true;
+    };
+    std::map<std::string, FileRecord> files;
+    std::map<std::string, std::pair<std::string, std::uint64_t>> datasets;
+    for (const auto *entry : entries) {
+        if (entry->n_events > 0ULL && !entry->friends.empty()) {
+            datasets.emplace(locateDatasetPath(*entry).string(),
+                             std::make_pair(entry->dataset_tree.empty() ? std::string{"events"} : entry->dataset_tree,
+                                            entry->n_events));
+        }
+        for (const auto &info : entry->friends) {
+            if (info.path.empty()) {
+                continue;
+            }
+            std::filesystem::path located(info.path);
+            if (located.is_relative()) {
+                located = std::filesystem::path(hubFor(*entry).directory) / located;
+            }
+            auto &record = files[located.string()];
+            record.tree = info.tree;
+            record.rntuple = info.format == kRNTupleFormat;
+            if (info.file_bytes > 0ULL) {
+                record.bytes = info.file_bytes;
+                record.checksum = info.checksum;
+            }
+            if (info.n_entries >= 0) {
+                record.rows = std::max(record.rows, info.entry_offset + static_cast<std::uint64_t>(info.n_entries));
+            } else {
+                record.counted = false;
+            }
+        }
+    }
+
+    auto treeEntries = [](const std::string &path, const std::string &tree_name) -> std::optional<Long64_t> {
+        std::unique_ptr<TFile> file(TFile::Open(path.c_str(), "READ"));
+        if (!file || file->IsZombie()) {
+            return std::nullopt;
+        }
+        auto *tree = file->Get<TTree>(tree_name.c_str());
+        return tree ? std::optional<Long64_t>(tree->GetEntries()) : std::nullopt;
+    };
+
+    std::vector<std::function<std::optional<std::string>()>> checks;
+    for (const auto &[path, record] : files) {
+        if (record.bytes == 0ULL && (!record.counted || record.rntuple)) {
+            continue;
+        }
+        checks.emplace_back([&, path = path, record = record]() -> std::optional<std::string> {
+            if (record.bytes > 0ULL) {
+                std::error_code ec;
+                const auto bytes = std::filesystem::file_size(path, ec);
+                if (ec) {
+                    return path + ": cannot be read (" + ec.message() + ")";
+                }
+                if (bytes != record.bytes) {
+                    return path + ": " + std::to_string(bytes) + " bytes, catalog records " +
+                           std::to_string(record.bytes);
+                }
+            }
+            if (record.counted && !record.rntuple) {
+                const auto rows = treeEntries(path, record.tree);
+                if (!rows) {
+                    return path + ": tree " + record.tree + " cannot be read";
+                }
+                if (static_cast<std::uint64_t>(*rows) != record.rows) {
+                    return path + ": " + std::to_string(*rows) + " entries, catalog records " +
+                           std::to_string(record.rows);
+                }
+            }
+            if (level == IntegrityCheck::kChecksums && record.bytes > 0ULL && fileChecksum(path) != record.checksum) {
+                return path + ": checksum does not match the catalog";
+            }
+            return std::nullopt;
+        });
+    }
+    for (const auto &[path, dataset] : datasets) {
+        checks.emplace_back([&, path = path, dataset = dataset]() -> std::optional<std::string> {
+            const auto rows = treeEntries(path, dataset.first);
+            if (rows && static_cast<std::uint64_t>(*rows) != dataset.second) {
+                return path + ": " + std::to_string(*rows) + " dataset entries, but its friends hold " +
+                       std::to_string(dataset.second);
+            }
+            return std::nullopt;
+        });
+    }
+
+    std::vector<std::optional<std::string>> results(checks.size());
+    std::atomic<std::size_t> next{0};
+    auto work = [&]() {
+        for (std::size_t idx = next++; idx < checks.size(); idx = next++) {
+            try {
+                results[idx] = checks[idx]();
+            } catch (const std::exception &ex) {
+                results[idx] = ex.what();
+            }
+        }
+    };
+    const std::size_t n_threads =
+        std::min<std::size_t>(checks.size(), std::max(1U, std::thread::hardware_concurrency()));
+    std::vector<std::thread> workers;
+    for (std::size_t i = 1; i < n_threads; ++i) {
+        workers.emplace_back(work);
+    }
+    work();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+
+    std::vector<std::string> problems;
+    for (auto &result : results) {
+        if (result) {
+            problems.push_back(std::move(*result));
+        }
+    }
+    return problems;
+}
+
+std::filesystem::path HubDataFrame::resolveDatasetPath(const CatalogEntry &entry, LocalFileCache::PinSet *pins) const {
+    return mirrored(locateDatasetPath(entry), pins);
 }
 
-std::filesystem::path HubDataFrame::resolveDatasetPath(const CatalogEntry &entry) const {
+std::filesystem::path HubDataFrame::locateDatasetPath(const CatalogEntry &entry) const {
+    const auto &hub = hubFor(entry);
     std::filesystem::path dataset_path(entry.dataset_path);
     if (dataset_path.is_absolute()) {
-        if (base_directory_override_ && !summary_.resolved_base_directory.empty()) {
+        if (base_directory_override_ && !hub.resolved_base_directory.empty()) {
             std::error_code ec;
             auto relative = std::filesystem::relative(
-                dataset_path, std::filesystem::path(summary_.resolved_base_directory), ec);
+                dataset_path, std::filesystem::path(hub.resolved_base_directory), ec);
             if (!ec) {
                 return std::filesystem::path(*base_directory_override_) / relative;
             }
@@ -317,29 +1429,54 @@ std::filesystem::path HubDataFrame::resolveDatasetPath(const CatalogEntry &entry
         return std::filesystem::path(*base_directory_override_) / dataset_path;
     }
 
-    if (!summary_.resolved_base_directory.empty()) {
-        return std::filesystem::path(summary_.resolved_base_directory) / dataset_path;
+    if (!hub.resolved_base_directory.empty()) {
+        return std::filesystem::path(hub.resolved_base_directory) / dataset_path;
     }
 
-    return std::filesystem::path(hub_directory_) / dataset_path;
+    return std::filesystem::path(hub.directory) / dataset_path;
 }
 
-std::filesystem::path HubDataFrame::resolveFriendPath(const CatalogEntry &entry) const {
-    return resolveFriendPath(entry.friend_path);
+std::filesystem::path HubDataFrame::resolveFriendPath(const CatalogEntry &entry, LocalFileCache::PinSet *pins) const {
+    return resolveFriendPath(entry, entry.friend_path, pins);
 }
 
-std::filesystem::path HubDataFrame::resolveFriendPath(const std::string &friend_path) const {
+std::filesystem::path HubDataFrame::resolveFriendPath(const CatalogEntry &entry, const std::string &friend_path,
+                                                      LocalFileCache::PinSet *pins) const {
     if (friend_path.empty()) {
         return {};
     }
     std::filesystem::path path(friend_path);
     if (path.is_absolute()) {
-        return path;
+        return mirrored(path, pins);
+    }
+    return mirrored(std::filesystem::path(hubFor(entry).directory) / path, pins);
+}
+
+const HubDataFrame::HubSource &HubDataFrame::hubFor(const CatalogEntry &entry) const {
+    if (entry.hub_index >= hubs_.size()) {
+        throw std::runtime_error("Catalog entry refers to an unknown hub index " + std::to_string(entry.hub_index));
     }
-    return std::filesystem::path(hub_directory_) / path;
+    return hubs_[entry.hub_index];
+}
+
+std::filesystem::path HubDataFrame::mirrored(const std::filesystem::path &path, LocalFileCache::PinSet *pins) const {
+    return local_cache_ ? local_cache_->resolve(path, pins) : path;
+}
+
+void HubDataFrame::setLocalCache(const std::filesystem::path &directory, std::uintmax_t budget_bytes) {
+    clearChainCache();
+    local_cache_ = std::make_unique<LocalFileCache>(directory, budget_bytes);
+    log::info("HubDataFrame", "Mirroring inputs into", local_cache_->directory().string(), "with a budget of",
+              budget_bytes, "bytes");
+}
+
+void HubDataFrame::clearLocalCache() {
+    clearChainCache();
+    local_cache_.reset();
 }
 
 void HubDataFrame::setBaseDirectoryOverride(const std::filesystem::path &path) {
+    clearChainCache();
     if (path.empty()) {
         base_directory_override_.reset();
         return;
@@ -348,7 +1485,10 @@ void HubDataFrame::setBaseDirectoryOverride(const std::filesystem::path &path) {
     base_directory_override_ = absolute_path.string();
 }
 
-void HubDataFrame::clearBaseDirectoryOverride() { base_directory_override_.reset(); }
+void HubDataFrame::clearBaseDirectoryOverride() {
+    clearChainCache();
+    base_directory_override_.reset();
+}
 
 std::filesystem::path HubDataFrame::resolvedBaseDirectory() const {
     if (base_directory_override_) {
@@ -360,6 +1500,96 @@ std::filesystem::path HubDataFrame::resolvedBaseDirectory() const {
     return std::filesystem::path(hub_directory_);
 }
 
+namespace {
+
+// Folds a hub's name -> id dictionary into the merged one and returns how that hub's ids map
+// onto the merged ids. Known names keep their merged id; new names keep their own id when it
+// is free and otherwise take the next unused one.
+template <typename Id>
+std::unordered_map<Id, Id> internDictionary(std::map<std::string, Id> &merged, const std::map<std::string, Id> &incoming,
+                                            const char *label) {
+    std::set<Id> used;
+    Id next = 0;
+    for (const auto &[name, id] : merged) {
+        used.insert(id);
+        next = std::max<Id>(next, static_cast<Id>(id + 1));
+    }
+
+    std::unordered_map<Id, Id> remap;
+    for (const auto &[name, id] : incoming) {
+        auto it = merged.find(name);
+        if (it == merged.end()) {
+            Id assigned = id;
+            if (used.count(id) != 0U) {
+                assigned = next;
+            }
+            it = merged.emplace(name, assigned).first;
+            used.insert(assigned);
+            next = std::max<Id>(next, static_cast<Id>(assigned + 1));
+        }
+        if (it->second != id) {
+            proc::log::info("HubDataFrame", "[debug]", "Re-interned", label, name, "from id", +id, "to", +it->second);
+        }
+        remap.emplace(id, it->second);
+    }
+    return remap;
+}
+
+template <typename Id>
+void remapId(Id &id, const std::unordered_map<Id, Id> &remap) {
+    const auto it = remap.find(id);
+    if (it != remap.end()) {
+        id = it->second;
+    }
+}
+
+} // namespace
+
+void HubDataFrame::mergeHub(HubDataFrame &&other) {
+    const auto hub_index = static_cast<std::uint32_t>(hubs_.size());
+    hubs_.push_back(other.hubs_.front());
+
+    const auto sample_remap =
+        internDictionary(provenance_dicts_.sample_ids, other.provenance_dicts_.sample_ids, "sample");
+    const auto beam_remap = internDictionary(provenance_dicts_.beam_ids, other.provenance_dicts_.beam_ids, "beam");
+    const auto period_remap =
+        internDictionary(provenance_dicts_.period_ids, other.provenance_dicts_.period_ids, "period");
+    internDictionary(provenance_dicts_.stage_ids, other.provenance_dicts_.stage_ids, "stage");
+    const auto variation_remap =
+        internDictionary(provenance_dicts_.variation_ids, other.provenance_dicts_.variation_ids, "variation");
+    const auto origin_remap =
+        internDictionary(provenance_dicts_.origin_ids, other.provenance_dicts_.origin_ids, "origin");
+
+    std::uint32_t next_entry_id = 0U;
+    for (const auto &entry : entries_) {
+        next_entry_id = std::max(next_entry_id, entry.entry_id + 1U);
+    }
+
+    entries_.reserve(entries_.size() + other.entries_.size());
+    for (auto &entry : other.entries_) {
+        entry.entry_id += next_entry_id;
+        entry.hub_index = hub_index;
+        remapId(entry.sample_id, sample_remap);
+        remapId(entry.beam_id, beam_remap);
+        remapId(entry.period_id, period_remap);
+        remapId(entry.variation_id, variation_remap);
+        remapId(entry.origin_id, origin_remap);
+        entries_.push_back(std::move(entry));
+    }
+
+    summary_.total_pot += other.summary_.total_pot;
+    summary_.total_triggers += other.summary_.total_triggers;
+}
+
+std::vector<std::string> HubDataFrame::hubPaths() const {
+    std::vector<std::string> paths;
+    paths.reserve(hubs_.size());
+    for (const auto &hub : hubs_) {
+        paths.push_back(hub.path);
+    }
+    return paths;
+}
+
 void HubDataFrame::loadMetadata() {
     summary_.friend_tree = "meta";
     try {
@@ -444,6 +1674,10 @@ void HubDataFrame::loadCatalog() {
         auto variations = catalog_df.Take<std::string>("variation").GetValue();
         auto origins = catalog_df.Take<std::string>("origin").GetValue();
         auto stages = catalog_df.Take<std::string>("stage").GetValue();
+        std::vector<std::string> friend_formats;
+        if (catalog_df.HasColumn("friend_format")) {
+            friend_formats = catalog_df.Take<std::string>("friend_format").GetValue();
+        }
 
         const std::size_t count = dataset_paths.size();
         entries_.clear();
@@ -460,6 +1694,7 @@ void HubDataFrame::loadCatalog() {
             entry.dataset_tree = (i < dataset_trees.size()) ? dataset_trees[i] : std::string{};
             entry.friend_path = (i < friend_paths.size()) ? friend_paths[i] : std::string{};
             entry.friend_tree = (i < friend_trees.size() && !friend_trees[i].empty()) ? friend_trees[i] : summary_.friend_tree;
+            entry.friend_format = (i < friend_formats.size()) ? friend_formats[i] : std::string{};
             entry.n_events = (i < n_events.size()) ? static_cast<std::uint64_t>(n_events[i]) : 0ULL;
             entry.first_event_uid = (i < first_uid.size()) ? static_cast<std::uint64_t>(first_uid[i]) : 0ULL;
             entry.last_event_uid = (i < last_uid.size()) ? static_cast<std::uint64_t>(last_uid[i]) : 0ULL;
@@ -475,7 +1710,8 @@ void HubDataFrame::loadCatalog() {
 
             entry.friends.clear();
             if (!entry.friend_path.empty()) {
-                entry.friends.push_back(CatalogEntry::FriendInfo{"", entry.friend_tree, entry.friend_path});
+                entry.friends.push_back(
+                    CatalogEntry::FriendInfo{"", entry.friend_tree, entry.friend_path, entry.friend_format});
             }
 
             entries_.push_back(std::move(entry));
@@ -487,6 +1723,7 @@ void HubDataFrame::loadCatalog() {
 
     if (!entries_.empty()) {
         loadFriendMetadata();
+        loadZoneMaps();
     }
 }
 
@@ -497,6 +1734,22 @@ void HubDataFrame::loadFriendMetadata() {
         auto labels = friend_df.Take<std::string>("label").GetValue();
         auto trees = friend_df.Take<std::string>("tree").GetValue();
         auto paths = friend_df.Take<std::string>("path").GetValue();
+        std::vector<std::string> formats;
+        if (friend_df.HasColumn("format")) {
+            formats = friend_df.Take<std::string>("format").GetValue();
+        }
+        std::vector<Long64_t> offsets;
+        if (friend_df.HasColumn("entry_offset")) {
+            offsets = friend_df.Take<Long64_t>("entry_offset").GetValue();
+        }
+        std::vector<Long64_t> row_counts;
+        std::vector<ULong64_t> sizes;
+        std::vector<ULong64_t> checksums;
+        if (friend_df.HasColumn("checksum")) {
+            row_counts = friend_df.Take<Long64_t>("n_entries").GetValue();
+            sizes = friend_df.Take<ULong64_t>("file_bytes").GetValue();
+            checksums = friend_df.Take<ULong64_t>("checksum").GetValue();
+        }
 
         std::unordered_map<std::uint32_t, std::vector<CatalogEntry::FriendInfo>> friend_map;
         const std::size_t count = entry_ids.size();
@@ -506,6 +1759,11 @@ void HubDataFrame::loadFriendMetadata() {
             info.label = (i < labels.size()) ? labels[i] : std::string{};
             info.tree = (i < trees.size()) ? trees[i] : std::string{};
             info.path = (i < paths.size()) ? paths[i] : std::string{};
+            info.format = (i < formats.size()) ? formats[i] : std::string{};
+            info.entry_offset = (i < offsets.size()) ? static_cast<std::uint64_t>(offsets[i]) : 0ULL;
+            info.n_entries = (i < row_counts.size()) ? static_cast<std::int64_t>(row_counts[i]) : -1;
+            info.file_bytes = (i < sizes.size()) ? static_cast<std::uint64_t>(sizes[i]) : 0ULL;
+            info.checksum = (i < checksums.size()) ? static_cast<std::uint64_t>(checksums[i]) : 0ULL;
             friend_map[static_cast<std::uint32_t>(entry_ids[i])].push_back(std::move(info));
         }
 
@@ -518,14 +1776,19 @@ void HubDataFrame::loadFriendMetadata() {
                 if (info.path.empty()) {
                     continue;
                 }
-                const bool duplicate = std::any_of(entry.friends.begin(), entry.friends.end(),
-                                                   [&](const CatalogEntry::FriendInfo &existing) {
-                                                       return existing.path == info.path &&
-                                                              existing.tree == info.tree &&
-                                                              existing.label == info.label;
-                                                   });
-                if (!duplicate) {
+                auto duplicate = std::find_if(entry.friends.begin(), entry.friends.end(),
+                                              [&](const CatalogEntry::FriendInfo &existing) {
+                                                  return existing.path == info.path && existing.tree == info.tree &&
+                                                         existing.label == info.label;
+                                              });
+                if (duplicate == entry.friends.end()) {
                     entry.friends.push_back(info);
+                } else {
+                    // The catalog row carries no offset or integrity record; the friend link row does.
+                    duplicate->entry_offset = info.entry_offset;
+                    duplicate->n_entries = info.n_entries;
+                    duplicate->file_bytes = info.file_bytes;
+                    duplicate->checksum = info.checksum;
                 }
             }
         }
@@ -534,6 +1797,50 @@ void HubDataFrame::loadFriendMetadata() {
     }
 }
 
+void HubDataFrame::loadZoneMaps() {
+    try {
+        ROOT::RDataFrame stats_df(kStatsTreeName, hub_path_);
+        auto entry_ids = stats_df.Take<UInt_t>("entry_id").GetValue();
+        auto columns = stats_df.Take<std::string>("column").GetValue();
+        auto kinds = stats_df.Take<std::string>("kind").GetValue();
+        auto keys = stats_df.Take<Long64_t>("key").GetValue();
+        auto values = stats_df.Take<Double_t>("value").GetValue();
+
+        std::unordered_map<std::uint32_t, CatalogEntry *> by_id;
+        by_id.reserve(entries_.size());
+        for (auto &entry : entries_) {
+            by_id.emplace(entry.entry_id, &entry);
+        }
+
+        for (std::size_t i = 0; i < entry_ids.size(); ++i) {
+            auto it = by_id.find(static_cast<std::uint32_t>(entry_ids[i]));
+            if (it == by_id.end()) {
+                continue;
+            }
+            auto &zone_map = it->second->zone_map;
+            zone_map.available = true;
+
+            const auto &column = columns[i];
+            const auto &kind = kinds[i];
+            const double value = values[i];
+            if (kind == "pass_count") {
+                zone_map.pass_counts[column] = static_cast<std::uint64_t>(value);
+            } else if (kind == "pass_yield") {
+                zone_map.pass_yields[column] = value;
+            } else if (kind == "min" || kind == "max") {
+                auto [range, inserted] = zone_map.ranges.emplace(column, std::make_pair(value, value));
+                if (!inserted) {
+                    (kind == "min" ? range->second.first : range->second.second) = value;
+                }
+            } else if (kind == "category_count") {
+                zone_map.category_counts[column][static_cast<std::int64_t>(keys[i])] = static_cast<std::uint64_t>(value);
+            }
+        }
+    } catch (const std::exception &ex) {
+        log::info("HubDataFrame", "[debug]", "No zone maps available:", ex.what());
+    }
+}
+
 std::vector<HubDataFrame::Combination> HubDataFrame::getAllCombinations() const {
     std::vector<Combination> combinations;
     combinations.reserve(entries_.size());
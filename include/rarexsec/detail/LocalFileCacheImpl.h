@@ -0,0 +1,340 @@
+#ifndef RAREXSEC_DETAIL_LOCALFILECACHEIMPL_H
+#define RAREXSEC_DETAIL_LOCALFILECACHEIMPL_H
+
+#include <rarexsec/LocalFileCache.h>
+#include <rarexsec/LoggerUtils.h>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace proc {
+
+namespace local_cache_detail {
+
+constexpr const char *kLockFileName = ".lock";
+constexpr const char *kTempPrefix = ".tmp-";
+constexpr const char *kReservePrefix = ".reserve-";
+
+inline bool isBookkeepingFile(const std::filesystem::path &path) {
+    const auto name = path.filename().string();
+    return !name.empty() && name.front() == '.';
+}
+
+inline bool isReservation(const std::filesystem::path &path) {
+    return path.filename().string().rfind(kReservePrefix, 0) == 0;
+}
+
+// Distinguishes the bookkeeping files of concurrent copies, across processes and threads.
+inline std::string copierTag() {
+    std::ostringstream tag;
+    tag << ::getpid() << '-' << std::hash<std::thread::id>{}(std::this_thread::get_id());
+    return tag.str();
+}
+
+} // namespace local_cache_detail
+
+// Exclusive advisory lock on the cache directory, shared by every process using it.
+class LocalFileCache::DirectoryLock {
+  public:
+    explicit DirectoryLock(const std::filesystem::path &directory) {
+        const auto path = (directory / local_cache_detail::kLockFileName).string();
+        fd_ = ::open(path.c_str(), O_CREAT | O_RDWR, 0664);
+        if (fd_ >= 0 && ::flock(fd_, LOCK_EX) != 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    ~DirectoryLock() {
+        if (fd_ >= 0) {
+            ::flock(fd_, LOCK_UN);
+            ::close(fd_);
+        }
+    }
+
+    DirectoryLock(const DirectoryLock &) = delete;
+    DirectoryLock &operator=(const DirectoryLock &) = delete;
+
+    bool held() const noexcept { return fd_ >= 0; }
+
+  private:
+    int fd_ = -1;
+};
+
+// A shared flock on the copy. Eviction needs an exclusive one, so a pinned copy stays put
+// for every process sharing the cache.
+class LocalFileCache::Pin {
+  public:
+    explicit Pin(const std::filesystem::path &path) {
+        fd_ = ::open(path.c_str(), O_RDONLY);
+        if (fd_ >= 0 && ::flock(fd_, LOCK_SH) != 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    ~Pin() {
+        if (fd_ >= 0) {
+            ::flock(fd_, LOCK_UN);
+            ::close(fd_);
+        }
+    }
+
+    Pin(const Pin &) = delete;
+    Pin &operator=(const Pin &) = delete;
+
+    bool held() const noexcept { return fd_ >= 0; }
+
+  private:
+    int fd_ = -1;
+};
+
+// Marker holding the size of a copy in flight, created under the directory lock so that
+// concurrent misses count it against the budget. The copier keeps it exclusively flocked;
+// an unlocked marker was left by a process that died and is discarded.
+class LocalFileCache::Reservation {
+  public:
+    Reservation(const std::filesystem::path &directory, const std::string &name, std::uintmax_t bytes)
+        : path_(directory / (std::string{local_cache_detail::kReservePrefix} + local_cache_detail::copierTag() +
+                             '-' + name)) {
+        fd_ = ::open(path_.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0664);
+        if (fd_ < 0) {
+            return;
+        }
+        const auto text = std::to_string(bytes);
+        if (::flock(fd_, LOCK_EX) != 0 || ::write(fd_, text.data(), text.size()) != static_cast<ssize_t>(text.size())) {
+            release();
+        }
+    }
+
+    ~Reservation() { release(); }
+
+    Reservation(const Reservation &) = delete;
+    Reservation &operator=(const Reservation &) = delete;
+
+    bool held() const noexcept { return fd_ >= 0; }
+
+    void release() {
+        if (fd_ < 0) {
+            return;
+        }
+        std::error_code ec;
+        std::filesystem::remove(path_, ec);
+        ::flock(fd_, LOCK_UN);
+        ::close(fd_);
+        fd_ = -1;
+    }
+
+    // Bytes reserved by a live copier, or nullopt for a stale marker (which is removed).
+    static std::optional<std::uintmax_t> reserved(const std::filesystem::path &path) {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return std::nullopt;
+        }
+        if (::flock(fd, LOCK_SH | LOCK_NB) == 0) {
+            std::error_code ec;
+            std::filesystem::remove(path, ec);
+            ::flock(fd, LOCK_UN);
+            ::close(fd);
+            return std::nullopt;
+        }
+        char buffer[32] = {};
+        const auto length = ::read(fd, buffer, sizeof(buffer) - 1);
+        ::close(fd);
+        return length > 0 ? std::optional<std::uintmax_t>{std::strtoull(buffer, nullptr, 10)} : std::nullopt;
+    }
+
+  private:
+    std::filesystem::path path_;
+    int fd_ = -1;
+};
+
+LocalFileCache::LocalFileCache(const std::filesystem::path &directory, std::uintmax_t budget_bytes)
+    : directory_(std::filesystem::absolute(directory)), budget_bytes_(budget_bytes) {
+    std::error_code ec;
+    std::filesystem::create_directories(directory_, ec);
+    if (ec || !std::filesystem::is_directory(directory_)) {
+        throw std::runtime_error("Unable to create local file cache directory " + directory_.string());
+    }
+}
+
+std::filesystem::path LocalFileCache::resolve(const std::filesystem::path &source, PinSet *pins) const {
+    if (source.empty() || source.string().find("://") != std::string::npos) {
+        return source;
+    }
+
+    std::error_code ec;
+    if (!std::filesystem::is_regular_file(source, ec)) {
+        return source;
+    }
+    const auto size = std::filesystem::file_size(source, ec);
+    if (ec || size > budget_bytes_) {
+        return source;
+    }
+    const auto mtime = std::filesystem::last_write_time(source, ec);
+    if (ec) {
+        return source;
+    }
+
+    const auto target =
+        cachedPath(source, size, static_cast<std::int64_t>(mtime.time_since_epoch().count()));
+    // Called with the directory lock held, which every eviction also takes, so the copy cannot
+    // vanish between the existence check and the pin.
+    auto pin = [&]() {
+        auto held = std::make_shared<const Pin>(target);
+        if (!held->held()) {
+            return false;
+        }
+        std::error_code touch_ec;
+        std::filesystem::last_write_time(target, std::filesystem::file_time_type::clock::now(), touch_ec);
+        if (pins) {
+            pins->push_back(std::move(held));
+        }
+        return true;
+    };
+
+    std::optional<Reservation> reservation;
+    {
+        DirectoryLock lock(directory_);
+        if (!lock.held()) {
+            log::info("LocalFileCache", "[warning]", "Unable to lock", directory_.string(), "; reading",
+                      source.string(), "directly");
+            return source;
+        }
+        if (std::filesystem::exists(target, ec) && pin()) {
+            return target;
+        }
+        if (!evictFor(size)) {
+            log::info("LocalFileCache", "[debug]", "Budget is held by copies in use; reading", source.string(),
+                      "directly");
+            return source;
+        }
+        reservation.emplace(directory_, target.filename().string(), size);
+        if (!reservation->held()) {
+            return source;
+        }
+    }
+
+    // The copy is made under a hidden name and renamed into place, so readers never see a
+    // partial file. Concurrent copies of the same key are harmless: the last rename wins.
+    const auto temp = directory_ / (std::string{local_cache_detail::kTempPrefix} + local_cache_detail::copierTag() +
+                                    '-' + target.filename().string());
+
+    std::filesystem::copy_file(source, temp, std::filesystem::copy_options::overwrite_existing, ec);
+    if (ec) {
+        log::info("LocalFileCache", "[warning]", "Failed to mirror", source.string(), ":", ec.message());
+        std::filesystem::remove(temp, ec);
+        return source;
+    }
+
+    DirectoryLock lock(directory_);
+    std::filesystem::rename(temp, target, ec);
+    reservation->release();
+    if (ec) {
+        std::error_code cleanup_ec;
+        std::filesystem::remove(temp, cleanup_ec);
+    }
+    if (std::filesystem::exists(target, ec) && pin()) {
+        log::info("LocalFileCache", "[debug]", "Mirrored", source.string(), "to", target.string());
+        return target;
+    }
+    return source;
+}
+
+std::uintmax_t LocalFileCache::usage() const {
+    std::uintmax_t total = 0;
+    std::error_code ec;
+    for (std::filesystem::directory_iterator it(directory_, ec), end; !ec && it != end; it.increment(ec)) {
+        if (local_cache_detail::isBookkeepingFile(it->path()) || !it->is_regular_file(ec)) {
+            continue;
+        }
+        total += it->file_size(ec);
+    }
+    return total;
+}
+
+std::filesystem::path LocalFileCache::cachedPath(const std::filesystem::path &source, std::uintmax_t size,
+                                                 std::int64_t mtime) const {
+    const auto absolute_source = std::filesystem::absolute(source).lexically_normal().string();
+    const auto key = absolute_source + '\0' + std::to_string(size) + '\0' + std::to_string(mtime);
+
+    std::ostringstream name;
+    name << std::hex << std::setw(16) << std::setfill('0') << std::hash<std::string>{}(key) << '-'
+         << source.filename().string();
+    return directory_ / name.str();
+}
+
+// Called with the directory lock held. Recency is the modification time of the cached copy,
+// which resolve() refreshes on every hit. Bytes reserved by copies in flight count as used,
+// and pinned copies are skipped.
+bool LocalFileCache::evictFor(std::uintmax_t incoming) const {
+    struct Cached {
+        std::filesystem::path path;
+        std::filesystem::file_time_type last_used;
+        std::uintmax_t size;
+    };
+
+    std::vector<Cached> cached;
+    std::uintmax_t total = 0;
+    std::error_code ec;
+    for (std::filesystem::directory_iterator it(directory_, ec), end; !ec && it != end; it.increment(ec)) {
+        if (local_cache_detail::isReservation(it->path())) {
+            total += Reservation::reserved(it->path()).value_or(0);
+            continue;
+        }
+        if (local_cache_detail::isBookkeepingFile(it->path()) || !it->is_regular_file(ec)) {
+            continue;
+        }
+        std::error_code entry_ec;
+        Cached entry{it->path(), it->last_write_time(entry_ec), it->file_size(entry_ec)};
+        if (entry_ec) {
+            continue;
+        }
+        total += entry.size;
+        cached.push_back(std::move(entry));
+    }
+
+    if (total + incoming <= budget_bytes_) {
+        return true;
+    }
+
+    std::sort(cached.begin(), cached.end(),
+              [](const Cached &a, const Cached &b) { return a.last_used < b.last_used; });
+    for (const auto &entry : cached) {
+        if (total + incoming <= budget_bytes_) {
+            break;
+        }
+        const int fd = ::open(entry.path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            continue;
+        }
+        if (::flock(fd, LOCK_EX | LOCK_NB) == 0) {
+            std::error_code remove_ec;
+            if (std::filesystem::remove(entry.path, remove_ec)) {
+                total -= entry.size;
+                log::info("LocalFileCache", "[debug]", "Evicted", entry.path.filename().string());
+            }
+            ::flock(fd, LOCK_UN);
+        }
+        ::close(fd);
+    }
+    return total + incoming <= budget_bytes_;
+}
+
+} // namespace proc
+
+#endif
@@ -2,40 +2,262 @@
 
 #include <rarexsec/LoggerUtils.h>
 
+#include "TBranch.h"
+#include "TFile.h"
+#include "TLeaf.h"
+#include "TMemFile.h"
+#include "TROOT.h"
+#include "TStopwatch.h"
+#include "TTree.h"
+#include "TTreeReader.h"
+#include "TTreeReaderValue.h"
+#include <ROOT/RResultHandle.hxx>
+#include <RVersion.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
 #include <filesystem>
+#include <functional>
 #include <iomanip>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <sstream>
+#include <stdexcept>
 #include <system_error>
+#include <thread>
+#include <utility>
 
 namespace proc {
 
+namespace {
+
+constexpr const char *kFlagWordName = "flag_bits";
+constexpr int kFlagsPerWord = 32;
+// Category codes are stored as UChar_t holding code + 1, so the -1 used for "no truth" fits.
+constexpr int kCategoryOffset = 1;
+
+bool endsWith(const std::string &value, const std::string &suffix) {
+    return value.size() >= suffix.size() && value.compare(value.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Leaf-list code of a fundamental leaf type, or 0 when it has none.
+char leafTypeCode(const std::string &type) {
+    static const std::map<std::string, char> codes{
+        {"Char_t", 'B'},  {"UChar_t", 'b'},  {"Short_t", 'S'},  {"UShort_t", 's'},  {"Int_t", 'I'},  {"UInt_t", 'i'},
+        {"Float_t", 'F'}, {"Double_t", 'D'}, {"Long64_t", 'L'}, {"ULong64_t", 'l'}, {"Bool_t", 'O'}};
+    const auto it = codes.find(type);
+    return it == codes.end() ? '\0' : it->second;
+}
+
+void ensureParentDirectory(const std::filesystem::path &path) {
+    const auto parent = path.parent_path();
+    if (parent.empty()) {
+        return;
+    }
+    std::error_code dir_ec;
+    std::filesystem::create_directories(parent, dir_ec);
+    if (dir_ec) {
+        log::info("FriendWriter", "[warning]", "Failed to ensure friend parent directory", parent.string(), ":",
+                  dir_ec.message());
+    }
+}
+
+bool isCollectionType(const std::string &type) {
+    return type.find("RVec") != std::string::npos || type.find("vector") != std::string::npos;
+}
+
+FriendWriter::ClusterBoundaries clusterEdges(TTree &tree) {
+    FriendWriter::ClusterBoundaries edges{0};
+    const Long64_t entries = tree.GetEntries();
+    auto clusters = tree.GetClusterIterator(0);
+    while (clusters() < entries) {
+        edges.push_back(std::min(clusters.GetNextEntry(), entries));
+    }
+    return edges;
+}
+
+const char *compressionName(ROOT::ECompressionAlgorithm algorithm) {
+    switch (algorithm) {
+    case ROOT::kZLIB:
+        return "ZLIB";
+    case ROOT::kLZMA:
+        return "LZMA";
+    case ROOT::kLZ4:
+        return "LZ4";
+    case ROOT::kZSTD:
+        return "ZSTD";
+    default:
+        return "default";
+    }
+}
+
+} // namespace
+
+// Bounded job queue drained by worker threads. submit() blocks while depth jobs are waiting,
+// which keeps staged, uncompressed files from piling up on disk.
+class FriendWriter::CompressionQueue {
+  public:
+    CompressionQueue(std::size_t threads, std::size_t depth) : depth_(std::max<std::size_t>(depth, 1)) {
+        ROOT::EnableThreadSafety();
+        for (std::size_t i = 0; i < threads; ++i) {
+            workers_.emplace_back([this] { this->run(); });
+        }
+    }
+
+    ~CompressionQueue() {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            idle_.wait(lock, [this] { return jobs_.empty() && active_ == 0; });
+            stop_ = true;
+            if (error_) {
+                log::info("FriendWriter", "[warning]", "Background compression failed and was never flushed");
+            }
+        }
+        work_ready_.notify_all();
+        for (auto &worker : workers_) {
+            worker.join();
+        }
+    }
+
+    CompressionQueue(const CompressionQueue &) = delete;
+    CompressionQueue &operator=(const CompressionQueue &) = delete;
+
+    void submit(std::function<void()> job) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            space_free_.wait(lock, [this] { return jobs_.size() < depth_; });
+            jobs_.push_back(std::move(job));
+        }
+        work_ready_.notify_one();
+    }
+
+    void wait() {
+        std::exception_ptr error;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            idle_.wait(lock, [this] { return jobs_.empty() && active_ == 0; });
+            std::swap(error, error_);
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+  private:
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            work_ready_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+            if (jobs_.empty()) {
+                return;
+            }
+            auto job = std::move(jobs_.front());
+            jobs_.pop_front();
+            ++active_;
+            lock.unlock();
+            space_free_.notify_one();
+            try {
+                job();
+            } catch (...) {
+                std::lock_guard<std::mutex> guard(mutex_);
+                if (!error_) {
+                    error_ = std::current_exception();
+                }
+            }
+            lock.lock();
+            --active_;
+            if (jobs_.empty() && active_ == 0) {
+                idle_.notify_all();
+            }
+        }
+    }
+
+    const std::size_t depth_;
+    std::deque<std::function<void()>> jobs_;
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable work_ready_;
+    std::condition_variable space_free_;
+    std::condition_variable idle_;
+    std::size_t active_ = 0;
+    bool stop_ = false;
+    std::exception_ptr error_;
+};
+
 FriendWriter::FriendWriter(const FriendConfig &config) : config_(config) {
+#if ROOT_VERSION_CODE < ROOT_VERSION(6, 34, 0)
+    if (config_.output_format == FriendFormat::kRNTuple) {
+        throw std::runtime_error("RNTuple friend output requires ROOT 6.34 or newer");
+    }
+#endif
     std::error_code ec;
     std::filesystem::create_directories(config_.output_dir, ec);
     if (ec) {
         log::info("FriendWriter", "[warning]", "Failed to ensure friend output directory", config_.output_dir.string(),
                   ":", ec.message());
     }
+    if (config_.compression_threads > 0 && config_.output_format == FriendFormat::kTTree) {
+        auto synchronous = config_;
+        synchronous.compression_threads = 0;
+        finisher_ = std::make_shared<const FriendWriter>(synchronous);
+        queue_ = std::make_shared<CompressionQueue>(config_.compression_threads, config_.compression_queue_depth);
+    }
+}
+
+void FriendWriter::flush() const {
+    if (queue_) {
+        queue_->wait();
+    }
 }
 
 ROOT::RDF::RSnapshotOptions FriendWriter::makeSnapshotOptions() const {
     ROOT::RDF::RSnapshotOptions opt;
     opt.fCompressionAlgorithm = config_.compression_algo;
-    opt.fCompressionLevel = config_.compression_level;
+    opt.fCompressionLevel = queue_ ? 0 : config_.compression_level;
     opt.fAutoFlush = -30 * 1024 * 1024;
     opt.fSplitLevel = 0;
     opt.fOverwriteIfExists = true;
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6, 34, 0)
+    if (config_.output_format == FriendFormat::kRNTuple) {
+        opt.fOutputFormat = ROOT::RDF::ESnapshotOutputFormat::kRNTuple;
+    }
+#endif
 
     return opt;
 }
 
+FriendWriter::ClusterBoundaries
+FriendWriter::inputClusters(const std::vector<std::pair<std::string, std::string>> &inputs) {
+    ClusterBoundaries edges{0};
+    for (const auto &[path, tree_name] : inputs) {
+        std::unique_ptr<TFile> file(TFile::Open(path.c_str(), "READ"));
+        auto *tree = (file && !file->IsZombie()) ? file->Get<TTree>(tree_name.c_str()) : nullptr;
+        if (!tree) {
+            log::info("FriendWriter", "[warning]", "Unable to read clusters of", tree_name, "in", path,
+                      "; friend clusters will not be aligned");
+            return {};
+        }
+        const Long64_t offset = edges.back();
+        const auto local = clusterEdges(*tree);
+        for (std::size_t i = 1; i < local.size(); ++i) {
+            edges.push_back(offset + local[i]);
+        }
+    }
+    return edges;
+}
+
 std::filesystem::path FriendWriter::writeFriend(ROOT::RDF::RNode df,
                                                 const std::string &sample_key,
                                                 const std::string &variation,
-                                                const std::vector<std::string> &columns) const {
+                                                const std::vector<std::string> &columns,
+                                                const ClusterBoundaries &clusters) const {
     auto path = generateFriendPath(sample_key, variation);
     auto options = makeSnapshotOptions();
-    return writeFriendToPath(df, path, columns, options);
+    return writeFriendToPath(df, path, columns, clusters, options);
 }
 
 std::filesystem::path FriendWriter::generateFriendPath(const std::string &sample_key,
@@ -47,30 +269,768 @@ std::filesystem::path FriendWriter::generateFriendPath(const std::string &sample
 
 std::filesystem::path FriendWriter::writeFriendToPath(ROOT::RDF::RNode df,
                                                       const std::filesystem::path &path,
-                                                      const std::vector<std::string> &columns) const {
+                                                      const std::vector<std::string> &columns,
+                                                      const ClusterBoundaries &clusters) const {
     auto options = makeSnapshotOptions();
-    return writeFriendToPath(df, path, columns, options);
+    return writeFriendToPath(df, path, columns, clusters, options);
 }
 
 std::filesystem::path FriendWriter::writeFriendToPath(ROOT::RDF::RNode df,
                                                       const std::filesystem::path &path,
                                                       const std::vector<std::string> &columns,
+                                                      const ClusterBoundaries &clusters,
                                                       const ROOT::RDF::RSnapshotOptions &options) const {
-    std::filesystem::path resolved = path;
-    const auto parent = resolved.parent_path();
-    if (!parent.empty()) {
-        std::error_code dir_ec;
-        std::filesystem::create_directories(parent, dir_ec);
-        if (dir_ec) {
-            log::info("FriendWriter", "[warning]", "Failed to ensure friend parent directory", parent.string(),
-                      ":", dir_ec.message());
+    ensureParentDirectory(path);
+    auto snapshot = df.Snapshot(config_.tree_name, path.string(), columns, options);
+    snapshot.GetValue();
+    return finishFriend(df, path, columns, clusters);
+}
+
+void FriendWriter::writeFriends(const std::vector<FriendTarget> &targets, const ClusterBoundaries &clusters) {
+    std::vector<ROOT::RDF::RResultHandle> snapshots;
+    snapshots.reserve(targets.size());
+    for (const auto &target : targets) {
+        ensureParentDirectory(target.path);
+        auto options = target.writer->makeSnapshotOptions();
+        options.fLazy = true;
+        auto node = target.node;
+        snapshots.emplace_back(
+            node.Snapshot(target.writer->config_.tree_name, target.path.string(), target.columns, options));
+    }
+    ROOT::RDF::RunGraphs(std::move(snapshots));
+    for (const auto &target : targets) {
+        target.writer->finishFriend(target.node, target.path, target.columns, clusters);
+    }
+}
+
+std::filesystem::path FriendWriter::finishFriend(ROOT::RDF::RNode df, const std::filesystem::path &path,
+                                                 const std::vector<std::string> &columns,
+                                                 const ClusterBoundaries &clusters) const {
+    if (config_.output_format == FriendFormat::kRNTuple) {
+        return path;
+    }
+
+    auto policies = hasCompressionPolicies() ? resolveCompressionPolicies(df, columns)
+                                             : std::map<std::string, CompressionPolicy>{};
+
+    if (queue_) {
+        queue_->submit([finisher = finisher_, path, columns, policies = std::move(policies), clusters]() mutable {
+            finisher->finishStaged(path, columns, std::move(policies), std::move(clusters));
+        });
+        return path;
+    }
+
+    if (!policies.empty() || config_.auto_compression || config_.pack_columns || clusters.size() > 1U) {
+        rewrite(path, columns, std::move(policies), clusters);
+    }
+
+    writeSideTables(path, columns);
+
+    return path;
+}
+
+// Runs on a compression worker. Empty friends are left alone, since the caller may be
+// deleting them concurrently.
+void FriendWriter::finishStaged(const std::filesystem::path &path, const std::vector<std::string> &columns,
+                                std::map<std::string, CompressionPolicy> policies, ClusterBoundaries clusters) const {
+    {
+        std::unique_ptr<TFile> file(TFile::Open(path.string().c_str(), "READ"));
+        auto *tree = file && !file->IsZombie() ? file->Get<TTree>(config_.tree_name.c_str()) : nullptr;
+        if (!tree || tree->GetEntries() == 0) {
+            return;
         }
     }
+    rewrite(path, columns, std::move(policies), std::move(clusters), true);
+    writeSideTables(path, columns);
+}
 
-    auto snapshot = df.Snapshot(config_.tree_name, resolved.string(), columns, options);
-    snapshot.GetValue();
+void FriendWriter::writeSideTables(const std::filesystem::path &path, const std::vector<std::string> &columns) const {
+    const bool has_uid = std::find(columns.begin(), columns.end(), "event_uid") != columns.end();
+    const bool has_zone_map_columns = std::any_of(columns.begin(), columns.end(), [&](const std::string &column) {
+        return std::find(config_.zone_map_flags.begin(), config_.zone_map_flags.end(), column) !=
+                   config_.zone_map_flags.end() ||
+               std::find(config_.zone_map_ranges.begin(), config_.zone_map_ranges.end(), column) !=
+                   config_.zone_map_ranges.end();
+    });
+    if (!has_uid && !has_zone_map_columns) {
+        return;
+    }
+
+    std::unique_ptr<TFile> file(TFile::Open(path.string().c_str(), "UPDATE"));
+    if (!file || file->IsZombie()) {
+        log::info("FriendWriter", "[warning]", "Unable to reopen", path.string(), "to write friend side tables");
+        return;
+    }
+    auto *tree = file->Get<TTree>(config_.tree_name.c_str());
+    if (!tree) {
+        return;
+    }
+
+    if (has_zone_map_columns) {
+        writeClusterZoneMap(*file, *tree, columns);
+    }
+    // A packed friend does not store event_uid; its index was written while packing.
+    if (has_uid && tree->GetBranch("event_uid")) {
+        writeUidIndex(*file, *tree);
+    }
+    file->Close();
+}
+
+void FriendWriter::writeUidIndex(TFile &file, TTree &tree) const {
+    std::vector<std::pair<ULong64_t, Long64_t>> index;
+    index.reserve(static_cast<std::size_t>(tree.GetEntries()));
+    {
+        TTreeReader reader(&tree);
+        TTreeReaderValue<ULong64_t> uid(reader, "event_uid");
+        while (reader.Next()) {
+            index.emplace_back(*uid, reader.GetCurrentEntry());
+        }
+    }
+    writeUidTable(file, std::move(index));
+}
+
+void FriendWriter::writeUidTable(TFile &file, std::vector<std::pair<ULong64_t, Long64_t>> index) const {
+    std::sort(index.begin(), index.end());
+
+    file.cd();
+    auto *table = new TTree(uidIndexName(config_.tree_name).c_str(), "Friend entries sorted by event_uid");
+    table->SetDirectory(&file);
+    ULong64_t event_uid = 0ULL;
+    Long64_t entry = 0;
+    table->Branch("event_uid", &event_uid);
+    table->Branch("entry", &entry);
+    for (const auto &row : index) {
+        event_uid = row.first;
+        entry = row.second;
+        table->Fill();
+    }
+    table->Write("", TObject::kOverwrite);
+}
+
+void FriendWriter::writeClusterZoneMap(TFile &file, TTree &tree, const std::vector<std::string> &columns) const {
+    auto select = [&](const std::vector<std::string> &candidates) {
+        std::vector<std::string> selected;
+        for (const auto &candidate : candidates) {
+            if (std::find(columns.begin(), columns.end(), candidate) != columns.end()) {
+                selected.push_back(candidate);
+            }
+        }
+        return selected;
+    };
+    const auto flags = select(config_.zone_map_flags);
+    const auto ranges = select(config_.zone_map_ranges);
+
+    const Long64_t n_entries = tree.GetEntries();
+    std::vector<std::pair<Long64_t, Long64_t>> clusters;
+    auto cluster_it = tree.GetClusterIterator(0);
+    Long64_t cluster_start = 0;
+    while ((cluster_start = cluster_it()) < n_entries) {
+        clusters.emplace_back(cluster_start, std::min(cluster_it.GetNextEntry(), n_entries));
+    }
+
+    // Packed flags are read back from their bit-field word.
+    struct FlagReader {
+        std::unique_ptr<TTreeReaderValue<bool>> value;
+        std::unique_ptr<TTreeReaderValue<UInt_t>> word;
+        UInt_t mask = 0U;
+
+        bool operator()() { return value ? **value : (**word & mask) != 0U; }
+    };
+
+    const auto layout = readLayout(file);
+
+    TTreeReader reader(&tree);
+    std::vector<FlagReader> flag_readers;
+    std::vector<std::unique_ptr<TTreeReaderValue<double>>> range_readers;
+    for (const auto &flag : flags) {
+        FlagReader flag_reader;
+        auto packed = std::find_if(layout.begin(), layout.end(), [&](const PackedColumn &column) {
+            return column.column == flag && column.encoding == "bit";
+        });
+        if (packed != layout.end()) {
+            flag_reader.word = std::make_unique<TTreeReaderValue<UInt_t>>(reader, packed->source.c_str());
+            flag_reader.mask = 1U << packed->bit;
+        } else {
+            flag_reader.value = std::make_unique<TTreeReaderValue<bool>>(reader, flag.c_str());
+        }
+        flag_readers.push_back(std::move(flag_reader));
+    }
+    for (const auto &column : ranges) {
+        range_readers.push_back(std::make_unique<TTreeReaderValue<double>>(reader, column.c_str()));
+    }
 
-    return resolved;
+    file.cd();
+    auto *table = new TTree(clusterTableName(config_.tree_name).c_str(), "Friend cluster zone map");
+    table->SetDirectory(&file);
+    Long64_t entry_begin = 0;
+    Long64_t entry_end = 0;
+    std::vector<Long64_t> counts(flags.size(), 0);
+    std::vector<Double_t> minima(ranges.size(), 0.0);
+    std::vector<Double_t> maxima(ranges.size(), 0.0);
+    table->Branch("entry_begin", &entry_begin);
+    table->Branch("entry_end", &entry_end);
+    for (std::size_t idx = 0; idx < flags.size(); ++idx) {
+        table->Branch((flags[idx] + "_count").c_str(), &counts[idx]);
+    }
+    for (std::size_t idx = 0; idx < ranges.size(); ++idx) {
+        table->Branch((ranges[idx] + "_min").c_str(), &minima[idx]);
+        table->Branch((ranges[idx] + "_max").c_str(), &maxima[idx]);
+    }
+
+    for (const auto &[begin, end] : clusters) {
+        entry_begin = begin;
+        entry_end = end;
+        std::fill(counts.begin(), counts.end(), 0);
+        std::fill(minima.begin(), minima.end(), std::numeric_limits<Double_t>::infinity());
+        std::fill(maxima.begin(), maxima.end(), -std::numeric_limits<Double_t>::infinity());
+
+        for (Long64_t entry = begin; entry < end && reader.Next(); ++entry) {
+            for (std::size_t idx = 0; idx < flag_readers.size(); ++idx) {
+                counts[idx] += flag_readers[idx]() ? 1 : 0;
+            }
+            for (std::size_t idx = 0; idx < range_readers.size(); ++idx) {
+                const double value = **range_readers[idx];
+                minima[idx] = std::min(minima[idx], value);
+                maxima[idx] = std::max(maxima[idx], value);
+            }
+        }
+        table->Fill();
+    }
+
+    table->Write("", TObject::kOverwrite);
+}
+
+bool FriendWriter::hasCompressionPolicies() const {
+    return !config_.column_compression.empty() || !config_.type_compression.empty();
+}
+
+std::map<std::string, FriendWriter::CompressionPolicy>
+FriendWriter::resolveCompressionPolicies(ROOT::RDF::RNode &df, const std::vector<std::string> &columns) const {
+    std::map<std::string, CompressionPolicy> policies;
+    for (const auto &column : columns) {
+        if (auto it = config_.column_compression.find(column); it != config_.column_compression.end()) {
+            policies.emplace(column, it->second);
+            continue;
+        }
+        if (config_.type_compression.empty()) {
+            continue;
+        }
+        const auto type = df.GetColumnType(column);
+        auto it = config_.type_compression.find(type);
+        if (it == config_.type_compression.end()) {
+            it = config_.type_compression.find(isCollectionType(type) ? "collection" : "scalar");
+        }
+        if (it != config_.type_compression.end()) {
+            policies.emplace(column, it->second);
+        }
+    }
+    return policies;
+}
+
+// Snapshot writes every branch with one setting, so per-column codecs are applied by copying
+// the tree into a staging file with re-encoded baskets and moving it over the original.
+void FriendWriter::rewrite(const std::filesystem::path &path, const std::vector<std::string> &columns,
+                           std::map<std::string, CompressionPolicy> policies, ClusterBoundaries clusters,
+                           bool recompress_all) const {
+    auto staging = path;
+    staging += ".rewrite";
+
+    Long64_t bytes_before = 0;
+    Long64_t bytes_after = 0;
+    {
+        std::unique_ptr<TFile> input(TFile::Open(path.string().c_str(), "READ"));
+        if (!input || input->IsZombie()) {
+            log::info("FriendWriter", "[warning]", "Unable to reopen", path.string(), "for per-column compression");
+            return;
+        }
+        auto *tree = input->Get<TTree>(config_.tree_name.c_str());
+        if (!tree) {
+            return;
+        }
+
+        if (clusters.size() > 1U) {
+            if (clusters.back() != tree->GetEntries()) {
+                log::info("FriendWriter", "[warning]", "Input clusters cover", clusters.back(), "entries but",
+                          path.filename().string(), "has", tree->GetEntries(), "; clusters are not aligned");
+                clusters.clear();
+            } else if (clusterEdges(*tree) == clusters) {
+                clusters.clear();
+            }
+        }
+
+        if (config_.auto_compression) {
+            for (const auto &column : columns) {
+                if (policies.count(column) == 0U && tree->GetBranch(column.c_str())) {
+                    policies.emplace(column, chooseCompression(*tree, column));
+                }
+            }
+        }
+        const auto layout = config_.pack_columns ? planPacking(*tree, columns) : std::vector<PackedColumn>{};
+        const auto groups = planSharedCounts(*tree);
+        if (!recompress_all && policies.empty() && clusters.empty() && layout.empty() && groups.empty()) {
+            return;
+        }
+
+        std::unique_ptr<TFile> output(TFile::Open(staging.string().c_str(), "RECREATE"));
+        if (!output || output->IsZombie()) {
+            log::info("FriendWriter", "[warning]", "Unable to create", staging.string(), "to rewrite the friend");
+            return;
+        }
+        output->SetCompressionSettings(ROOT::CompressionSettings(config_.compression_algo, config_.compression_level));
+        output->cd();
+        // Packed and grouped columns are left out of the clone and given new branches below.
+        std::vector<std::string> replaced;
+        for (const auto &packed : layout) {
+            replaced.push_back(packed.column);
+            if (packed.encoding == "bitarray") {
+                replaced.emplace_back(tree->GetLeaf(packed.column.c_str())->GetLeafCount()->GetBranch()->GetName());
+            }
+        }
+        for (const auto &group : groups) {
+            replaced.insert(replaced.end(), group.columns.begin(), group.columns.end());
+            replaced.insert(replaced.end(), group.count_branches.begin(), group.count_branches.end());
+        }
+        for (const auto &name : replaced) {
+            tree->SetBranchStatus(name.c_str(), 0);
+        }
+        auto *clone = tree->CloneTree(0);
+        clone->SetDirectory(output.get());
+        for (const auto &name : replaced) {
+            tree->SetBranchStatus(name.c_str(), 1);
+        }
+
+        // Grouped arrays are read and written through the same buffers, so the copy is free.
+        std::vector<Int_t> shared_lengths(groups.size(), 0);
+        std::vector<std::unique_ptr<char[]>> arrays;
+        for (std::size_t idx = 0; idx < groups.size(); ++idx) {
+            const auto &group = groups[idx];
+            clone->Branch(group.count.c_str(), &shared_lengths[idx], (group.count + "/I").c_str());
+            for (const auto &count_branch : group.count_branches) {
+                tree->GetBranch(count_branch.c_str())->SetAddress(&shared_lengths[idx]);
+            }
+            for (const auto &column : group.columns) {
+                auto *branch = tree->GetBranch(column.c_str());
+                auto *leaf = branch->GetLeaf(column.c_str());
+                const auto bytes = static_cast<std::size_t>(std::max(group.max_length, 1) * leaf->GetLenType());
+                arrays.emplace_back(new char[bytes]());
+                branch->SetAddress(arrays.back().get());
+                const std::string leaf_list = column + "[" + group.count + "]/" + leafTypeCode(leaf->GetTypeName());
+                clone->Branch(column.c_str(), arrays.back().get(), leaf_list.c_str());
+            }
+            log::info("FriendWriter", "[debug]", "Columns", group.columns.size(), "share the count branch",
+                      group.count);
+        }
+
+        const std::size_t n_packed = layout.size();
+        std::unique_ptr<bool[]> flag_values(new bool[n_packed]());
+        std::vector<Int_t> wide_values(n_packed, 0);
+        std::vector<UChar_t> narrow_values(n_packed, 0);
+        // Bit arrays: the source bools and their count, and the packed bytes and theirs.
+        std::vector<std::unique_ptr<bool[]>> mask_values(n_packed);
+        std::vector<Int_t> mask_lengths(n_packed, 0);
+        std::vector<std::unique_ptr<UChar_t[]>> mask_bytes(n_packed);
+        std::vector<Int_t> mask_byte_counts(n_packed, 0);
+        std::map<std::string, UInt_t> words;
+        ULong64_t event_uid = 0ULL;
+        std::vector<std::pair<ULong64_t, Long64_t>> uid_index;
+        for (std::size_t idx = 0; idx < n_packed; ++idx) {
+            const auto &packed = layout[idx];
+            if (packed.encoding == "bit") {
+                tree->SetBranchAddress(packed.column.c_str(), &flag_values[idx]);
+                words.emplace(packed.source, 0U);
+            } else if (packed.encoding == "uint8") {
+                tree->SetBranchAddress(packed.column.c_str(), &wide_values[idx]);
+                clone->Branch(packed.source.c_str(), &narrow_values[idx], (packed.source + "/b").c_str());
+            } else if (packed.encoding == "bitarray") {
+                auto *count_branch = tree->GetLeaf(packed.column.c_str())->GetLeafCount()->GetBranch();
+                Int_t max_length = 0;
+                count_branch->SetAddress(&mask_lengths[idx]);
+                for (Long64_t entry = 0; entry < tree->GetEntries(); ++entry) {
+                    count_branch->GetEntry(entry);
+                    max_length = std::max(max_length, mask_lengths[idx]);
+                }
+                mask_values[idx].reset(new bool[static_cast<std::size_t>(max_length) + 1U]());
+                mask_bytes[idx].reset(new UChar_t[static_cast<std::size_t>(max_length) / 8U + 1U]());
+                tree->GetBranch(packed.column.c_str())->SetAddress(mask_values[idx].get());
+                const std::string count = packed.source + "_bytes";
+                clone->Branch(count.c_str(), &mask_byte_counts[idx], (count + "/I").c_str());
+                clone->Branch(packed.source.c_str(), mask_bytes[idx].get(),
+                              (packed.source + "[" + count + "]/b").c_str());
+            } else {
+                tree->SetBranchAddress(packed.column.c_str(), &event_uid);
+                uid_index.reserve(static_cast<std::size_t>(tree->GetEntries()));
+            }
+        }
+        for (auto &[name, word] : words) {
+            clone->Branch(name.c_str(), &word, (name + "/i").c_str());
+        }
+
+        // Clones inherit the source's per-branch settings, which are "none" for staged files.
+        if (recompress_all) {
+            const auto settings = ROOT::CompressionSettings(config_.compression_algo, config_.compression_level);
+            auto *branches = clone->GetListOfBranches();
+            for (int idx = 0; idx < branches->GetEntries(); ++idx) {
+                if (auto *branch = dynamic_cast<TBranch *>(branches->At(idx))) {
+                    branch->SetCompressionSettings(settings);
+                }
+            }
+        }
+        for (const auto &[column, policy] : policies) {
+            if (auto *branch = clone->GetBranch(column.c_str())) {
+                branch->SetCompressionSettings(ROOT::CompressionSettings(policy.algorithm, policy.level));
+                log::info("FriendWriter", "[debug]", "Compressing", column, "with", compressionName(policy.algorithm),
+                          policy.level);
+            }
+        }
+        if (clusters.empty() && layout.empty() && groups.empty()) {
+            clone->CopyEntries(tree);
+        } else {
+            // Clusters are closed by hand at the input's edges instead of by size.
+            if (!clusters.empty()) {
+                clone->SetAutoFlush(0);
+            }
+            std::size_t next_edge = 1;
+            for (Long64_t entry = 0; entry < tree->GetEntries(); ++entry) {
+                tree->GetEntry(entry);
+                for (auto &[name, word] : words) {
+                    word = 0U;
+                }
+                for (std::size_t idx = 0; idx < n_packed; ++idx) {
+                    const auto &packed = layout[idx];
+                    if (packed.encoding == "bit") {
+                        if (flag_values[idx]) {
+                            words[packed.source] |= 1U << packed.bit;
+                        }
+                    } else if (packed.encoding == "uint8") {
+                        narrow_values[idx] = static_cast<UChar_t>(wide_values[idx] + packed.bit);
+                    } else if (packed.encoding == "bitarray") {
+                        // Bit i holds element i; a stop bit after the last one encodes the length.
+                        const auto length = static_cast<std::size_t>(mask_lengths[idx]);
+                        auto *bytes = mask_bytes[idx].get();
+                        mask_byte_counts[idx] = static_cast<Int_t>(length / 8U + 1U);
+                        std::fill(bytes, bytes + mask_byte_counts[idx], UChar_t{0});
+                        for (std::size_t bit = 0; bit < length; ++bit) {
+                            if (mask_values[idx][bit]) {
+                                bytes[bit / 8U] |= static_cast<UChar_t>(1U << (bit % 8U));
+                            }
+                        }
+                        bytes[length / 8U] |= static_cast<UChar_t>(1U << (length % 8U));
+                    } else {
+                        uid_index.emplace_back(event_uid, entry);
+                    }
+                }
+                clone->Fill();
+                if (!clusters.empty() && entry + 1 == clusters[next_edge]) {
+                    clone->FlushBaskets();
+                    ++next_edge;
+                }
+            }
+            if (!clusters.empty()) {
+                log::info("FriendWriter", "[debug]", "Aligned", path.filename().string(), "to", clusters.size() - 1,
+                          "input clusters");
+            }
+        }
+        clone->Write("", TObject::kOverwrite);
+        if (!layout.empty()) {
+            writeLayout(*output, layout);
+            if (!uid_index.empty()) {
+                writeUidTable(*output, std::move(uid_index));
+            }
+        }
+        bytes_before = tree->GetZipBytes();
+        bytes_after = clone->GetZipBytes();
+        output->Close();
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(staging, path, ec);
+    if (ec) {
+        log::info("FriendWriter", "[warning]", "Failed to replace", path.string(), "with its rewritten copy:",
+                  ec.message());
+        std::filesystem::remove(staging, ec);
+        return;
+    }
+    log::info("FriendWriter", "Rewrote", path.filename().string(), ":", bytes_before, "->", bytes_after, "bytes");
+}
+
+std::vector<FriendWriter::PackedColumn> FriendWriter::planPacking(TTree &tree,
+                                                                  const std::vector<std::string> &columns) const {
+    std::set<std::string> grouped;
+    for (const auto &[count, members] : config_.shared_counts) {
+        grouped.insert(members.begin(), members.end());
+    }
+
+    std::vector<PackedColumn> layout;
+    int flags = 0;
+    for (const auto &column : columns) {
+        auto *branch = tree.GetBranch(column.c_str());
+        auto *leaf = branch ? branch->GetLeaf(column.c_str()) : nullptr;
+        if (!leaf) {
+            continue;
+        }
+        const std::string type = leaf->GetTypeName();
+        if (auto *count = leaf->GetLeafCount()) {
+            // Variable-length bool arrays (muon_mask) become bit arrays. Their count branch is
+            // dropped, so it must not size any other column.
+            bool shared = grouped.count(column) != 0U;
+            auto *leaves = tree.GetListOfLeaves();
+            for (int idx = 0; !shared && leaves && idx < leaves->GetEntries(); ++idx) {
+                auto *other = dynamic_cast<TLeaf *>(leaves->At(idx));
+                shared = other && other != leaf && other->GetLeafCount() == count;
+            }
+            if (type == "Bool_t" && !shared) {
+                layout.push_back(PackedColumn{column, "bitarray", column + "_bits", 0});
+            }
+            continue;
+        }
+        if (leaf->GetLenStatic() != 1) {
+            continue;
+        }
+        if (type == "Bool_t") {
+            const int word = flags / kFlagsPerWord;
+            const std::string source = word == 0 ? kFlagWordName : kFlagWordName + ("_" + std::to_string(word));
+            layout.push_back(PackedColumn{column, "bit", source, flags % kFlagsPerWord});
+            ++flags;
+        } else if (type == "Int_t" && endsWith(column, "_category")) {
+            // Every file must share the layout for the chain to line up, so a code that does
+            // not fit is an error rather than a reason to keep this file wide.
+            Int_t value = 0;
+            branch->SetAddress(&value);
+            for (Long64_t entry = 0; entry < tree.GetEntries(); ++entry) {
+                branch->GetEntry(entry);
+                if (value + kCategoryOffset < 0 || value + kCategoryOffset > std::numeric_limits<UChar_t>::max()) {
+                    branch->ResetAddress();
+                    throw std::runtime_error("Category " + column + " holds " + std::to_string(value) +
+                                             ", which does not fit the packed 8-bit layout");
+                }
+            }
+            branch->ResetAddress();
+            layout.push_back(PackedColumn{column, "uint8", column + "_u8", kCategoryOffset});
+        } else if (type == "ULong64_t" && column == "event_uid" && config_.derive_event_uid) {
+            // Only uids built from run/sub/evt can be rebuilt on read. The snapshot writes 0
+            // for datasets without them, which the writer's setting must not have covered.
+            ULong64_t value = 0ULL;
+            branch->SetAddress(&value);
+            for (Long64_t entry = 0; entry < tree.GetEntries(); ++entry) {
+                branch->GetEntry(entry);
+                if (value == 0ULL) {
+                    branch->ResetAddress();
+                    throw std::runtime_error("event_uid is 0 at entry " + std::to_string(entry) +
+                                             ", so it cannot be derived from run/sub/evt on read");
+                }
+            }
+            branch->ResetAddress();
+            layout.push_back(PackedColumn{column, "derived", "run:sub:evt", 0});
+        }
+    }
+    return layout;
+}
+
+std::vector<FriendWriter::SharedCountGroup> FriendWriter::planSharedCounts(TTree &tree) const {
+    std::vector<SharedCountGroup> groups;
+    const Long64_t entries = tree.GetEntries();
+    for (const auto &[count, members] : config_.shared_counts) {
+        SharedCountGroup group;
+        group.count = count;
+        std::vector<Int_t> lengths;
+        for (const auto &column : members) {
+            auto *branch = tree.GetBranch(column.c_str());
+            auto *leaf = branch ? branch->GetLeaf(column.c_str()) : nullptr;
+            auto *count_leaf = leaf ? leaf->GetLeafCount() : nullptr;
+            if (!count_leaf || leafTypeCode(leaf->GetTypeName()) == '\0' ||
+                std::string(count_leaf->GetTypeName()) != "Int_t") {
+                continue;
+            }
+
+            auto *count_branch = count_leaf->GetBranch();
+            std::vector<Int_t> column_lengths(static_cast<std::size_t>(entries), 0);
+            Int_t length = 0;
+            count_branch->SetAddress(&length);
+            for (Long64_t entry = 0; entry < entries; ++entry) {
+                count_branch->GetEntry(entry);
+                column_lengths[static_cast<std::size_t>(entry)] = length;
+            }
+            count_branch->ResetAddress();
+
+            // Like the packed layout, the grouping must be the same in every file of a chain.
+            if (group.columns.empty()) {
+                lengths = std::move(column_lengths);
+            } else if (column_lengths != lengths) {
+                throw std::runtime_error(column + " does not have the per-event length of the other columns sharing " +
+                                         count);
+            }
+            group.columns.push_back(column);
+            group.count_branches.emplace_back(count_branch->GetName());
+        }
+        if (group.columns.size() < 2U) {
+            continue;
+        }
+        if (tree.GetBranch(count.c_str())) {
+            throw std::runtime_error("Shared count branch " + count + " clashes with an existing branch");
+        }
+        group.max_length = lengths.empty() ? 0 : *std::max_element(lengths.begin(), lengths.end());
+        groups.push_back(std::move(group));
+    }
+    return groups;
+}
+
+void FriendWriter::writeLayout(TFile &file, const std::vector<PackedColumn> &layout) const {
+    file.cd();
+    auto *table = new TTree(layoutTableName(config_.tree_name).c_str(), "Packed friend column layout");
+    table->SetDirectory(&file);
+    PackedColumn row;
+    table->Branch("column", &row.column);
+    table->Branch("encoding", &row.encoding);
+    table->Branch("source", &row.source);
+    table->Branch("bit", &row.bit);
+    for (const auto &packed : layout) {
+        row = packed;
+        table->Fill();
+    }
+    table->Write("", TObject::kOverwrite);
+}
+
+std::vector<FriendWriter::PackedColumn> FriendWriter::readLayout(TFile &file) const {
+    std::vector<PackedColumn> layout;
+    auto *table = file.Get<TTree>(layoutTableName(config_.tree_name).c_str());
+    if (!table) {
+        return layout;
+    }
+    TTreeReader reader(table);
+    TTreeReaderValue<std::string> column(reader, "column");
+    TTreeReaderValue<std::string> encoding(reader, "encoding");
+    TTreeReaderValue<std::string> source(reader, "source");
+    TTreeReaderValue<int> bit(reader, "bit");
+    while (reader.Next()) {
+        layout.push_back(PackedColumn{*column, *encoding, *source, *bit});
+    }
+    return layout;
+}
+
+FriendWriter::CompressionPolicy FriendWriter::chooseCompression(TTree &tree, const std::string &column) const {
+    static const std::vector<CompressionPolicy> candidates{
+        {ROOT::kLZ4, 4}, {ROOT::kZSTD, 4}, {ROOT::kZSTD, 9}, {ROOT::kLZMA, 7}};
+    constexpr std::size_t kSampleClusters = 3;
+    constexpr int kRepetitions = 3;
+
+    CompressionPolicy fallback;
+    fallback.algorithm = config_.compression_algo;
+    fallback.level = config_.compression_level;
+
+    // Clusters spread over the file, so one unrepresentative stretch does not decide the codec.
+    const auto edges = clusterEdges(tree);
+    std::vector<std::pair<Long64_t, Long64_t>> sample;
+    const std::size_t n_clusters = edges.empty() ? 0U : edges.size() - 1U;
+    for (std::size_t pick = 0; pick < std::min(kSampleClusters, n_clusters); ++pick) {
+        const std::size_t index =
+            n_clusters <= kSampleClusters ? pick : pick * (n_clusters - 1U) / (kSampleClusters - 1U);
+        sample.emplace_back(edges[index], edges[index + 1U]);
+    }
+    if (sample.empty()) {
+        return fallback;
+    }
+
+    struct Trial {
+        CompressionPolicy policy;
+        Long64_t bytes;
+        double write_seconds;
+        double read_seconds;
+    };
+    std::vector<Trial> trials;
+
+    // The caller's branch statuses are put back once the trials are done.
+    std::vector<std::pair<std::string, bool>> statuses;
+    std::function<void(TObjArray *)> record = [&](TObjArray *branches) {
+        for (int idx = 0; branches && idx < branches->GetEntries(); ++idx) {
+            if (auto *branch = dynamic_cast<TBranch *>(branches->At(idx))) {
+                statuses.emplace_back(branch->GetName(), tree.GetBranchStatus(branch->GetName()));
+                record(branch->GetListOfBranches());
+            }
+        }
+    };
+    record(tree.GetListOfBranches());
+
+    TMemFile scratch("friend_compression_trial", "RECREATE");
+    tree.SetBranchStatus("*", false);
+    tree.SetBranchStatus(column.c_str(), true);
+    for (const auto &candidate : candidates) {
+        scratch.cd();
+        std::unique_ptr<TTree> trial(tree.CloneTree(0));
+        auto *branch = trial ? trial->GetBranch(column.c_str()) : nullptr;
+        if (!branch) {
+            continue;
+        }
+        branch->SetCompressionSettings(ROOT::CompressionSettings(candidate.algorithm, candidate.level));
+
+        // Compression happens as baskets fill and flush, so only those are timed, not the
+        // reads of the source tree.
+        TStopwatch write_watch;
+        write_watch.Reset();
+        Long64_t sampled = 0;
+        for (const auto &[begin, end] : sample) {
+            for (Long64_t entry = begin; entry < end; ++entry) {
+                tree.GetEntry(entry);
+                write_watch.Start(false);
+                trial->Fill();
+                write_watch.Stop();
+                ++sampled;
+            }
+        }
+        write_watch.Start(false);
+        trial->FlushBaskets();
+        write_watch.Stop();
+
+        // The fastest of several passes, each decompressing every basket afresh.
+        double read_seconds = std::numeric_limits<double>::infinity();
+        for (int repetition = 0; repetition < kRepetitions; ++repetition) {
+            branch->DropBaskets("all");
+            TStopwatch read_watch;
+            read_watch.Start();
+            for (Long64_t entry = 0; entry < sampled; ++entry) {
+                branch->GetEntry(entry);
+            }
+            read_watch.Stop();
+            read_seconds = std::min(read_seconds, read_watch.RealTime());
+        }
+        trials.push_back(Trial{candidate, branch->GetZipBytes(), write_watch.RealTime(), read_seconds});
+    }
+    for (const auto &[name, status] : statuses) {
+        tree.SetBranchStatus(name.c_str(), status);
+    }
+
+    if (trials.empty()) {
+        return fallback;
+    }
+
+    // The objective sets how much slower than the fastest codec a smaller one may read and
+    // write. Read speed ignores the write cost, and size ignores both.
+    double read_tolerance = 2.0;
+    double write_tolerance = 2.0;
+    if (config_.compression_objective == CompressionObjective::kReadSpeed) {
+        read_tolerance = 1.1;
+        write_tolerance = std::numeric_limits<double>::infinity();
+    } else if (config_.compression_objective == CompressionObjective::kSize) {
+        read_tolerance = std::numeric_limits<double>::infinity();
+        write_tolerance = std::numeric_limits<double>::infinity();
+    }
+    double fastest_read = std::numeric_limits<double>::infinity();
+    double fastest_write = std::numeric_limits<double>::infinity();
+    for (const auto &trial : trials) {
+        fastest_read = std::min(fastest_read, trial.read_seconds);
+        fastest_write = std::min(fastest_write, trial.write_seconds);
+    }
+
+    const Trial *best = nullptr;
+    for (const auto &trial : trials) {
+        if (trial.read_seconds > fastest_read * read_tolerance ||
+            trial.write_seconds > fastest_write * write_tolerance) {
+            continue;
+        }
+        if (!best || trial.bytes < best->bytes) {
+            best = &trial;
+        }
+    }
+    return best ? best->policy : fallback;
 }
 
 } // namespace proc
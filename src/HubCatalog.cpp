@@ -9,6 +9,7 @@
 #include <nlohmann/json.hpp>
 
 #include <algorithm>
+#include <map>
 #include <stdexcept>
 #include <utility>
 
@@ -17,9 +18,11 @@ namespace {
 constexpr const char *kCatalogTreeName = "entries";
 constexpr const char *kMetaTreeName = "hub_meta";
 constexpr const char *kFriendTreeName = "entry_friends";
+constexpr const char *kStatsTreeName = "entry_stats";
 constexpr const char *kCatalogTreeTitle = "Hub entries";
 constexpr const char *kMetaTreeTitle = "Hub metadata";
 constexpr const char *kFriendTreeTitle = "Entry friend metadata";
+constexpr const char *kStatsTreeTitle = "Entry zone maps";
 
 template <typename T>
 void ensureBranch(TTree *tree, const char *name, T *address) {
@@ -32,12 +35,58 @@ void ensureBranch(TTree *tree, const char *name, T *address) {
         tree->Branch(name, address);
     }
 }
+
+void bindEntryBranches(TTree *tree, HubEntry &entry) {
+    ensureBranch(tree, "entry_id", &entry.entry_id);
+    ensureBranch(tree, "sample_id", &entry.sample_id);
+    ensureBranch(tree, "beam_id", &entry.beam_id);
+    ensureBranch(tree, "period_id", &entry.period_id);
+    ensureBranch(tree, "variation_id", &entry.variation_id);
+    ensureBranch(tree, "origin_id", &entry.origin_id);
+    ensureBranch(tree, "dataset_path", &entry.dataset_path);
+    ensureBranch(tree, "dataset_tree", &entry.dataset_tree);
+    ensureBranch(tree, "friend_path", &entry.friend_path);
+    ensureBranch(tree, "friend_tree", &entry.friend_tree);
+    ensureBranch(tree, "friend_format", &entry.friend_format);
+    ensureBranch(tree, "n_events", &entry.n_events);
+    ensureBranch(tree, "first_event_uid", &entry.first_event_uid);
+    ensureBranch(tree, "last_event_uid", &entry.last_event_uid);
+    ensureBranch(tree, "sum_weights", &entry.sum_weights);
+    ensureBranch(tree, "pot", &entry.pot);
+    ensureBranch(tree, "triggers", &entry.triggers);
+    ensureBranch(tree, "sample_key", &entry.sample_key);
+    ensureBranch(tree, "beam", &entry.beam);
+    ensureBranch(tree, "period", &entry.period);
+    ensureBranch(tree, "variation", &entry.variation);
+    ensureBranch(tree, "origin", &entry.origin);
+    ensureBranch(tree, "stage", &entry.stage);
+}
+
+void bindFriendBranches(TTree *tree, HubFriend &friend_entry, bool add_missing_columns = true) {
+    ensureBranch(tree, "entry_id", &friend_entry.entry_id);
+    ensureBranch(tree, "label", &friend_entry.label);
+    ensureBranch(tree, "tree", &friend_entry.tree);
+    ensureBranch(tree, "path", &friend_entry.path);
+    if (add_missing_columns || tree->GetBranch("format")) {
+        ensureBranch(tree, "format", &friend_entry.format);
+    }
+    if (add_missing_columns || tree->GetBranch("entry_offset")) {
+        ensureBranch(tree, "entry_offset", &friend_entry.entry_offset);
+    }
+    if (add_missing_columns || tree->GetBranch("checksum")) {
+        ensureBranch(tree, "n_entries", &friend_entry.n_entries);
+        ensureBranch(tree, "file_bytes", &friend_entry.file_bytes);
+        ensureBranch(tree, "checksum", &friend_entry.checksum);
+    }
+}
 } // namespace
 
 HubCatalog::HubCatalog(const std::string &hub_path, OpenMode mode)
     : catalog_tree_(nullptr),
       meta_tree_(nullptr),
       friend_tree_(nullptr),
+      stats_tree_(nullptr),
+      current_stat_entry_id_(0U),
       next_entry_id_(0U),
       finalized_(false) {
     const char *open_mode = nullptr;
@@ -63,28 +112,7 @@ HubCatalog::HubCatalog(const std::string &hub_path, OpenMode mode)
         file_->cd();
         catalog_tree_ = new TTree(kCatalogTreeName, kCatalogTreeTitle);
         catalog_tree_->SetDirectory(file_.get());
-        ensureBranch(catalog_tree_, "entry_id", &current_entry_.entry_id);
-        ensureBranch(catalog_tree_, "sample_id", &current_entry_.sample_id);
-        ensureBranch(catalog_tree_, "beam_id", &current_entry_.beam_id);
-        ensureBranch(catalog_tree_, "period_id", &current_entry_.period_id);
-        ensureBranch(catalog_tree_, "variation_id", &current_entry_.variation_id);
-        ensureBranch(catalog_tree_, "origin_id", &current_entry_.origin_id);
-        ensureBranch(catalog_tree_, "dataset_path", &current_entry_.dataset_path);
-        ensureBranch(catalog_tree_, "dataset_tree", &current_entry_.dataset_tree);
-        ensureBranch(catalog_tree_, "friend_path", &current_entry_.friend_path);
-        ensureBranch(catalog_tree_, "friend_tree", &current_entry_.friend_tree);
-        ensureBranch(catalog_tree_, "n_events", &current_entry_.n_events);
-        ensureBranch(catalog_tree_, "first_event_uid", &current_entry_.first_event_uid);
-        ensureBranch(catalog_tree_, "last_event_uid", &current_entry_.last_event_uid);
-        ensureBranch(catalog_tree_, "sum_weights", &current_entry_.sum_weights);
-        ensureBranch(catalog_tree_, "pot", &current_entry_.pot);
-        ensureBranch(catalog_tree_, "triggers", &current_entry_.triggers);
-        ensureBranch(catalog_tree_, "sample_key", &current_entry_.sample_key);
-        ensureBranch(catalog_tree_, "beam", &current_entry_.beam);
-        ensureBranch(catalog_tree_, "period", &current_entry_.period);
-        ensureBranch(catalog_tree_, "variation", &current_entry_.variation);
-        ensureBranch(catalog_tree_, "origin", &current_entry_.origin);
-        ensureBranch(catalog_tree_, "stage", &current_entry_.stage);
+        bindEntryBranches(catalog_tree_, current_entry_);
 
         meta_tree_ = new TTree(kMetaTreeName, kMetaTreeTitle);
         meta_tree_->SetDirectory(file_.get());
@@ -93,10 +121,15 @@ HubCatalog::HubCatalog(const std::string &hub_path, OpenMode mode)
 
         friend_tree_ = new TTree(kFriendTreeName, kFriendTreeTitle);
         friend_tree_->SetDirectory(file_.get());
-        ensureBranch(friend_tree_, "entry_id", &current_friend_.entry_id);
-        ensureBranch(friend_tree_, "label", &current_friend_.label);
-        ensureBranch(friend_tree_, "tree", &current_friend_.tree);
-        ensureBranch(friend_tree_, "path", &current_friend_.path);
+        bindFriendBranches(friend_tree_, current_friend_);
+
+        stats_tree_ = new TTree(kStatsTreeName, kStatsTreeTitle);
+        stats_tree_->SetDirectory(file_.get());
+        ensureBranch(stats_tree_, "entry_id", &current_stat_entry_id_);
+        ensureBranch(stats_tree_, "column", &current_stat_.column);
+        ensureBranch(stats_tree_, "kind", &current_stat_.kind);
+        ensureBranch(stats_tree_, "key", &current_stat_.key);
+        ensureBranch(stats_tree_, "value", &current_stat_.value);
 
         meta_key_ = "hub_version";
         meta_value_ = "1";
@@ -105,6 +138,7 @@ HubCatalog::HubCatalog(const std::string &hub_path, OpenMode mode)
         catalog_tree_ = dynamic_cast<TTree *>(file_->Get(kCatalogTreeName));
         meta_tree_ = dynamic_cast<TTree *>(file_->Get(kMetaTreeName));
         friend_tree_ = dynamic_cast<TTree *>(file_->Get(kFriendTreeName));
+        stats_tree_ = dynamic_cast<TTree *>(file_->Get(kStatsTreeName));
         if (!catalog_tree_) {
             throw std::runtime_error("Hub catalog is missing the entries tree");
         }
@@ -117,10 +151,14 @@ HubCatalog::HubCatalog(const std::string &hub_path, OpenMode mode)
                 friend_tree_ = new TTree(kFriendTreeName, kFriendTreeTitle);
                 friend_tree_->SetDirectory(file_.get());
             }
-            ensureBranch(friend_tree_, "entry_id", &current_friend_.entry_id);
-            ensureBranch(friend_tree_, "label", &current_friend_.label);
-            ensureBranch(friend_tree_, "tree", &current_friend_.tree);
-            ensureBranch(friend_tree_, "path", &current_friend_.path);
+            // Older hubs lack the newer columns; adding them to a filled tree would misalign it.
+            bindFriendBranches(friend_tree_, current_friend_, friend_tree_->GetEntries() == 0);
+
+            ensureBranch(stats_tree_, "entry_id", &current_stat_entry_id_);
+            ensureBranch(stats_tree_, "column", &current_stat_.column);
+            ensureBranch(stats_tree_, "kind", &current_stat_.kind);
+            ensureBranch(stats_tree_, "key", &current_stat_.key);
+            ensureBranch(stats_tree_, "value", &current_stat_.value);
         }
 
         if (catalog_tree_) {
@@ -151,8 +189,21 @@ void HubCatalog::addEntry(const HubEntry &entry) {
         current_friend_.label.clear();
         current_friend_.tree = current_entry_.friend_tree;
         current_friend_.path = current_entry_.friend_path;
+        current_friend_.format = current_entry_.friend_format;
+        current_friend_.entry_offset = 0;
+        current_friend_.n_entries = static_cast<Long64_t>(current_entry_.n_events);
+        current_friend_.file_bytes = current_entry_.friend_bytes;
+        current_friend_.checksum = current_entry_.friend_checksum;
         friend_tree_->Fill();
     }
+
+    if (stats_tree_) {
+        current_stat_entry_id_ = current_entry_.entry_id;
+        for (const auto &stat : current_entry_.stats) {
+            current_stat_ = stat;
+            stats_tree_->Fill();
+        }
+    }
 }
 
 void HubCatalog::addEntries(const std::vector<HubEntry> &entries) {
@@ -177,6 +228,76 @@ void HubCatalog::addFriends(const std::vector<HubFriend> &friend_entries) {
     }
 }
 
+void HubCatalog::relocateFriends(const std::vector<HubFriendRelocation> &relocations) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!catalog_tree_ || !friend_tree_ || finalized_) {
+        throw std::runtime_error("Hub catalog must be open for update to relocate friends");
+    }
+    if (relocations.empty()) {
+        return;
+    }
+
+    std::map<std::pair<UInt_t, std::string>, const HubFriendRelocation *> lookup;
+    for (const auto &relocation : relocations) {
+        lookup[{relocation.entry_id, relocation.label}] = &relocation;
+    }
+
+    // Trees cannot be edited in place, so both are copied row by row into fresh trees that
+    // replace the originals when the catalog is finalised.
+    file_->cd();
+    bindEntryBranches(catalog_tree_, current_entry_);
+    auto *entries = catalog_tree_->CloneTree(0);
+    std::map<UInt_t, HubFriend> primaries;
+    for (Long64_t row = 0; row < catalog_tree_->GetEntries(); ++row) {
+        current_entry_ = HubEntry{};
+        catalog_tree_->GetEntry(row);
+        const auto it = lookup.find({current_entry_.entry_id, std::string{}});
+        if (it != lookup.end()) {
+            current_entry_.friend_path = it->second->path;
+            const auto &relocation = *it->second;
+            primaries[current_entry_.entry_id] =
+                HubFriend{current_entry_.entry_id, std::string{}, current_entry_.friend_tree, relocation.path,
+                          current_entry_.friend_format, relocation.entry_offset,
+                          relocation.n_entries >= 0 ? relocation.n_entries
+                                                    : static_cast<Long64_t>(current_entry_.n_events),
+                          relocation.file_bytes, relocation.checksum};
+        }
+        entries->Fill();
+    }
+
+    bindFriendBranches(friend_tree_, current_friend_);
+    auto *friends = friend_tree_->CloneTree(0);
+    for (Long64_t row = 0; row < friend_tree_->GetEntries(); ++row) {
+        current_friend_ = HubFriend{};
+        friend_tree_->GetEntry(row);
+        const auto it = lookup.find({current_friend_.entry_id, current_friend_.label});
+        if (it != lookup.end()) {
+            const auto &relocation = *it->second;
+            current_friend_.path = relocation.path;
+            current_friend_.entry_offset = relocation.entry_offset;
+            if (relocation.n_entries >= 0) {
+                current_friend_.n_entries = relocation.n_entries;
+            }
+            current_friend_.file_bytes = relocation.file_bytes;
+            current_friend_.checksum = relocation.checksum;
+            if (current_friend_.label.empty()) {
+                primaries.erase(current_friend_.entry_id);
+            }
+        }
+        friends->Fill();
+    }
+    // The offset of a primary friend lives on its link row, so add one where none exists.
+    for (const auto &[entry_id, primary] : primaries) {
+        current_friend_ = primary;
+        friends->Fill();
+    }
+
+    delete catalog_tree_;
+    delete friend_tree_;
+    catalog_tree_ = entries;
+    friend_tree_ = friends;
+}
+
 void HubCatalog::writeDictionaries(const ProvenanceDicts &dicts) {
     nlohmann::json dict_json;
     dict_json["sample2id"] = dicts.sample2id;
@@ -235,6 +356,9 @@ void HubCatalog::finalize() {
     if (friend_tree_) {
         friend_tree_->Write("", TObject::kOverwrite);
     }
+    if (stats_tree_) {
+        stats_tree_->Write("", TObject::kOverwrite);
+    }
     file_->Write("", TObject::kOverwrite);
     file_->Close();
     finalized_ = true;
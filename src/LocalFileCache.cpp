@@ -0,0 +1 @@
+#include <rarexsec/detail/LocalFileCacheImpl.h>
@@ -8,8 +8,10 @@
 #include <functional>
 #include <future>
 #include <iterator>
+#include <map>
 #include <memory>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 #include <string_view>
 #include <system_error>
@@ -79,14 +81,9 @@ static IdT intern(MapT &m, const KeyT &k) {
 
 constexpr const char *kInputTreeName = "nuselection/EventSelectionFilter";
 
-static ULong64_t buildEventUid(int run, int sub, int evt) {
-    return (static_cast<ULong64_t>(run) << 42U) | (static_cast<ULong64_t>(sub) << 21U) |
-           static_cast<ULong64_t>(evt);
-}
-
 static ROOT::RDF::RNode configureFriendNode(ROOT::RDF::RNode df, bool is_mc, uint64_t sampvar_uid) {
     if (df.HasColumn("run") && df.HasColumn("sub") && df.HasColumn("evt")) {
-        df = df.Define("event_uid", buildEventUid, {"run", "sub", "evt"});
+        df = df.Define("event_uid", proc::makeEventUid, {"run", "sub", "evt"});
     } else {
         df = df.Define("event_uid", []() { return 0ULL; });
     }
@@ -129,8 +126,24 @@ const std::vector<std::string> &baseFriendColumns() {
     return columns;
 }
 
+// Per-track muon columns; every event holds the same number of entries in each.
+const std::vector<std::string> &muonTrackColumns() {
+    static const std::vector<std::string> columns = {"muon_trk_score_v",
+                                                     "muon_trk_llr_pid_v",
+                                                     "muon_trk_start_x_v",
+                                                     "muon_trk_start_y_v",
+                                                     "muon_trk_start_z_v",
+                                                     "muon_trk_end_x_v",
+                                                     "muon_trk_end_y_v",
+                                                     "muon_trk_end_z_v",
+                                                     "muon_trk_length_v",
+                                                     "muon_trk_distance_v",
+                                                     "muon_pfp_generation_v"};
+    return columns;
+}
+
 std::vector<std::string> requestedFriendColumns() {
-    const std::vector<std::string> derived = {
+    std::vector<std::string> derived = {
         "nominal_event_weight",
         "base_event_weight",
         "pass_pre",
@@ -142,17 +155,6 @@ std::vector<std::string> requestedFriendColumns() {
         "quality_event",
         "in_reco_fiducial",
         "muon_mask",
-        "muon_trk_score_v",
-        "muon_trk_llr_pid_v",
-        "muon_trk_start_x_v",
-        "muon_trk_start_y_v",
-        "muon_trk_start_z_v",
-        "muon_trk_end_x_v",
-        "muon_trk_end_y_v",
-        "muon_trk_end_z_v",
-        "muon_trk_length_v",
-        "muon_trk_distance_v",
-        "muon_pfp_generation_v",
         "muon_track_costheta",
         "n_muons_tot",
         "has_muon",
@@ -169,6 +171,9 @@ std::vector<std::string> requestedFriendColumns() {
         "is_truth_signal",
         "pure_slice_signal"};
 
+    const auto mask = std::find(derived.begin(), derived.end(), "muon_mask");
+    derived.insert(std::next(mask), muonTrackColumns().begin(), muonTrackColumns().end());
+
     std::vector<std::string> columns = baseFriendColumns();
     columns.insert(columns.end(), derived.begin(), derived.end());
 
@@ -183,6 +188,14 @@ std::vector<std::string> requestedFriendColumns() {
     return unique;
 }
 
+// Columns summarised per entry in the hub zone maps.
+bool isZoneMapFlag(const std::string &column) { return column == "base_sel" || column.rfind("pass_", 0) == 0; }
+
+const std::vector<std::string> &zoneMapCategoryColumns() {
+    static const std::vector<std::string> columns = {"channel_definition_category"};
+    return columns;
+}
+
 std::vector<std::string> selectAvailableFriendColumns(std::vector<ROOT::RDF::RNode> &nodes,
                                                       const std::vector<std::string> &candidates) {
     if (nodes.empty()) {
@@ -457,8 +470,51 @@ std::vector<HubEntry> SnapshotPipelineBuilder::collectHubEntriesForNode(
     auto min_uid = node.Min<ULong64_t>("event_uid");
     auto max_uid = node.Max<ULong64_t>("event_uid");
     auto sum_weights = node.Sum<double>("w_nom");
+    auto min_weight = node.Min<double>("w_nom");
+    auto max_weight = node.Max<double>("w_nom");
 
-    auto path = writer.writeFriend(node, combo.sk, combo.vlab, friend_columns);
+    struct FlagStats {
+        std::string column;
+        ROOT::RDF::RResultPtr<ULong64_t> count;
+        ROOT::RDF::RResultPtr<double> yield;
+    };
+    std::vector<FlagStats> flag_stats;
+    for (const auto &column : friend_columns) {
+        if (!isZoneMapFlag(column)) {
+            continue;
+        }
+        auto passing = node.Filter([](bool value) { return value; }, {column});
+        flag_stats.push_back(FlagStats{column, passing.Count(), passing.Sum<double>("w_nom")});
+    }
+
+    using CategoryCounts = std::map<int, ULong64_t>;
+    std::vector<std::pair<std::string, ROOT::RDF::RResultPtr<CategoryCounts>>> category_stats;
+    for (const auto &column : zoneMapCategoryColumns()) {
+        if (std::find(friend_columns.begin(), friend_columns.end(), column) == friend_columns.end()) {
+            continue;
+        }
+        auto counts = node.Aggregate([](CategoryCounts &acc, int code) { ++acc[code]; },
+                                     [](std::vector<CategoryCounts> &partials) {
+                                         for (std::size_t idx = 1; idx < partials.size(); ++idx) {
+                                             for (const auto &[code, n] : partials[idx]) {
+                                                 partials.front()[code] += n;
+                                             }
+                                         }
+                                     },
+                                     column, CategoryCounts{});
+        category_stats.emplace_back(column, counts);
+    }
+
+    FriendWriter::ClusterBoundaries clusters;
+    if (align_friend_clusters_) {
+        std::filesystem::path dataset_path(combo.dataset_path);
+        if (dataset_path.is_relative()) {
+            dataset_path = std::filesystem::path(ntuple_base_directory_) / dataset_path;
+        }
+        clusters = FriendWriter::inputClusters({{dataset_path.string(), combo.dataset_tree}});
+    }
+
+    auto path = writer.writeFriend(node, combo.sk, combo.vlab, friend_columns, clusters);
 
     const auto n_events = count.GetValue();
     if (n_events == 0ULL) {
@@ -484,6 +540,7 @@ std::vector<HubEntry> SnapshotPipelineBuilder::collectHubEntriesForNode(
     const auto relative_friend = std::filesystem::relative(path, hub_dir, rel_ec);
     entry.friend_path = (rel_ec ? path : relative_friend).generic_string();
     entry.friend_tree = friend_tree_name;
+    entry.friend_format = friendFormatName(writer.config().output_format);
 
     entry.n_events = n_events;
     entry.first_event_uid = min_uid.GetValue();
@@ -498,6 +555,19 @@ std::vector<HubEntry> SnapshotPipelineBuilder::collectHubEntriesForNode(
     entry.origin = combo.origin_label;
     entry.stage = combo.stage;
 
+    entry.stats.push_back(HubEntryStat{"w_nom", "min", 0, min_weight.GetValue()});
+    entry.stats.push_back(HubEntryStat{"w_nom", "max", 0, max_weight.GetValue()});
+    for (auto &flag : flag_stats) {
+        entry.stats.push_back(
+            HubEntryStat{flag.column, "pass_count", 0, static_cast<Double_t>(flag.count.GetValue())});
+        entry.stats.push_back(HubEntryStat{flag.column, "pass_yield", 0, flag.yield.GetValue()});
+    }
+    for (auto &[column, counts] : category_stats) {
+        for (const auto &[code, n] : counts.GetValue()) {
+            entry.stats.push_back(HubEntryStat{column, "category_count", code, static_cast<Double_t>(n)});
+        }
+    }
+
     return std::vector<HubEntry>{std::move(entry)};
 }
 
@@ -516,6 +586,17 @@ void SnapshotPipelineBuilder::snapshotToHub(const std::string &hub_path,
     FriendWriter::FriendConfig friend_config;
     const std::filesystem::path hub_dir = std::filesystem::absolute(std::filesystem::path(hub_path)).parent_path();
     friend_config.output_dir = hub_dir / "friends";
+    friend_config.output_format = friend_format_;
+    friend_config.pack_columns = pack_friend_columns_;
+    friend_config.compression_threads = friend_compression_threads_;
+    if (pack_friend_columns_) {
+        friend_config.shared_counts.emplace("n_muon_trk", muonTrackColumns());
+        // Decided for the whole hub so every friend file shares one layout.
+        friend_config.derive_event_uid =
+            std::all_of(nodes.begin(), nodes.end(), [](ROOT::RDF::RNode &node) {
+                return node.HasColumn("run") && node.HasColumn("sub") && node.HasColumn("evt");
+            });
+    }
 
     FriendWriter writer(friend_config);
 
@@ -541,6 +622,22 @@ void SnapshotPipelineBuilder::snapshotToHub(const std::string &hub_path,
         all_entries.insert(all_entries.end(), std::make_move_iterator(entries.begin()),
                            std::make_move_iterator(entries.end()));
     }
+    writer.flush();
+
+    // Recorded only now, since background compression rewrites the files until flush() returns.
+    for (auto &entry : all_entries) {
+        std::filesystem::path friend_path(entry.friend_path);
+        if (friend_path.is_relative()) {
+            friend_path = hub_dir / friend_path;
+        }
+        std::error_code size_ec;
+        entry.friend_bytes = std::filesystem::file_size(friend_path, size_ec);
+        if (size_ec) {
+            entry.friend_bytes = 0ULL;
+            continue;
+        }
+        entry.friend_checksum = fileChecksum(friend_path.string());
+    }
 
     hub.addEntries(all_entries);
     hub.finalize();
@@ -549,6 +646,14 @@ void SnapshotPipelineBuilder::snapshotToHub(const std::string &hub_path,
               "hub entries with friend metadata:", hub_path);
 }
 
+void SnapshotPipelineBuilder::setFriendFormat(FriendFormat format) {
+    if (format != FriendFormat::kTTree) {
+        throw std::runtime_error("The primary hub friend must be a TTree: HubDataFrame::load() cannot join an "
+                                 "RNTuple friend; attach RNTuple columns as a labelled friend instead");
+    }
+    friend_format_ = format;
+}
+
 void SnapshotPipelineBuilder::printAllBranches() const {
     log::info("SnapshotPipelineBuilder::printAllBranches", "[debug]",
               "Available branches in loaded samples");